@@ -15,6 +15,10 @@
 #include <chrono>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <map>
+#include <deque>
 
 #include "support/compress.h"
 
@@ -164,7 +168,7 @@ size_t readFromBin(void* dest, const char* filename, long max_bytes) {
   return read_size;
 }
 
-void load_program(void* dest,const char* filename) {
+bool load_program(void* dest,const char* filename) {
   assert(filename != NULL);
   printf("The image is %s\n", filename);
   if (isGzFile(filename)) {
@@ -179,8 +183,7 @@ void load_program(void* dest,const char* filename) {
   }
 
   printf("load program size: 0x%lx\n", program_sz);
-  assert(program_sz > 0 && program_sz <= MEM_SIZE);
-  return;
+  return program_sz > 0 && program_sz <= MEM_SIZE;
 }
 
 // load gcpt
@@ -203,31 +206,39 @@ void overwrite_ram(void* mem, const char* filename) {
   fs.close();
 }
 
-void init_sim_mem(int &mem_fd, const char* filename, const char* gcptname){
-  mem_fd =  memfd_create("sim_mem", 0);
+int create_sim_mem() {
+  int mem_fd =  memfd_create("sim_mem", 0);
   if(mem_fd == -1){
     printf("Couldn't memfd_create\n");
     exit(-1);
   }
   ftruncate(mem_fd, MEM_SIZE);
+  return mem_fd;
+}
 
+/* decompress the image and the gcpt into mem_fd, which may be shared with the parent */
+bool load_sim_mem(int mem_fd, const char* filename, const char* gcptname) {
   auto mem = (uint64_t*)mmap(NULL, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
   if(mem == MAP_FAILED){
     printf("Couldn't mmap\n");
     exit(-1);
    }
   // This way, we only need to load those two file once when diff-testing
-  load_program(mem, filename);
-  overwrite_ram(mem, gcptname);
+  bool ret = load_program(mem, filename);
+  if (ret) overwrite_ram(mem, gcptname);
 
   munmap(mem, MEM_SIZE);
+  return ret;
 }
 
-uint64_t* new_mem(const char* filename, const char* gcptname){
- static int mem_fd =0;
- if(mem_fd == 0){
-  init_sim_mem(mem_fd, filename, gcptname);
- }
+bool init_sim_mem(int &mem_fd, const char* filename, const char* gcptname){
+  mem_fd = create_sim_mem();
+  bool ret = load_sim_mem(mem_fd, filename, gcptname);
+  if (!ret) close(mem_fd);
+  return ret;
+}
+
+uint64_t* new_mem(int mem_fd){
  auto mem = (uint64_t*)mmap(NULL, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, mem_fd, 0);
  if(mem == MAP_FAILED){
   printf("Couldn't mmap\n");
@@ -272,17 +283,31 @@ bool checkSignals(bool display) {
 }
 #endif
 
-int main(int argc, char** argv) {
+struct CheckpointResult {
+  uint64_t cycles;  // cycles after warmup
+  uint64_t instrs;  // instructions after warmup
+  bool warmed;      // whether the warmup finished
+};
+
+/* the models are built once, forked workers share them copy-on-write */
+static void new_models() {
 #ifdef GSIM
   dut = new DUT_NAME();
-  g_mem = new_mem(argv[2], argv[1]);
-  
   dut_init(dut);
-  dut_reset();
 #endif
 #ifdef VERILATOR
   ref = new REF_NAME();
-  v_mem = new_mem(argv[2], argv[1]);
+#endif
+}
+
+/* mem_fd holds the decompressed image with the gcpt, see init_sim_mem */
+static CheckpointResult run_checkpoint(int mem_fd) {
+#ifdef GSIM
+  g_mem = new_mem(mem_fd);
+  dut_reset();
+#endif
+#ifdef VERILATOR
+  v_mem = new_mem(mem_fd);
   ref_init(ref);
   ref_reset();
 #endif
@@ -294,6 +319,9 @@ int main(int argc, char** argv) {
     FILE* activeFp = fopen(ACTIVE_FILE, "w");
   #endif
   std::size_t instrCnt = 0;
+  CheckpointResult result = {0, 0, false};
+  uint64_t warmCycles = 0;
+  std::size_t warmInstrs = 0;
   auto start = std::chrono::system_clock::now();
   while (!dut_end) {
 #ifdef VERILATOR
@@ -321,7 +349,12 @@ int main(int argc, char** argv) {
       std::cout << "instrCnt = " << instrCnt << std::endl;
     }
 #endif
-  if (instrCnt >= warmupInsts) warmupInsts = -1;
+  if (instrCnt >= warmupInsts) {
+    warmupInsts = -1;
+    result.warmed = true;
+    warmCycles = cycles + 1; // instructions of this cycle are counted in warmInstrs
+    warmInstrs = instrCnt;
+  }
     cycles++;
 #if defined(VERILATOR) && defined(GSIM)
     bool isDiff = checkSignals(false);
@@ -331,7 +364,7 @@ int main(int argc, char** argv) {
       printf("ALL diffs: dut -- ref\n");
       printf("Failed after %ld cycles\n", cycles);
       checkSignals(false);
-      return -1;
+      exit(-1);
     }
 #endif
     if ((cycles % 100000) == 0 || dut_end || instrCnt >= MAX_INSTS) {
@@ -339,7 +372,7 @@ int main(int argc, char** argv) {
       auto dur = std::chrono::system_clock::now() - start;
       auto msec = std::chrono::duration_cast<std::chrono::milliseconds>(dur);
       fprintf(stderr, "cycles %ld (%ld ms, %ld per sec) instructs %zu\n",
-          cycles, msec.count(), cycles * 1000 / msec.count(), instrCnt);
+          cycles, msec.count(), msec.count() == 0 ? 0 : cycles * 1000 / msec.count(), instrCnt);
     }
     
   }
@@ -358,5 +391,210 @@ int main(int argc, char** argv) {
       tfp->flush();
       tfp->close();
 #endif
+  if (result.warmed) {
+    result.cycles = cycles - warmCycles;
+    result.instrs = instrCnt - warmInstrs;
+  }
+  return result;
+}
+
+/*
+  SimPoint runner: every checkpoint of the list runs in a forked worker, at most `jobs` at a time.
+  The parent builds the models once, so a worker starts from copy-on-write pages of the constructed
+  models and maps a MAP_PRIVATE view of its image (see new_mem). The images are decompressed into
+  memfds by forked loaders, at most `jobs` images ahead of the workers, so loading overlaps the
+  running workers and the parent keeps reaping and dispatching them. Every line of the list is
+  "<checkpoint> [weight]".
+*/
+struct SimPoint {
+  std::string path;
+  double weight;
+  CheckpointResult result;
+  bool done;
+};
+
+static std::vector<SimPoint> read_simpoint_list(const char* listname) {
+  std::vector<SimPoint> points;
+  std::ifstream list(listname);
+  if (!list.is_open()) {
+    printf("Can't open %s\n", listname);
+    exit(EXIT_FAILURE);
+  }
+  std::string line;
+  while (std::getline(list, line)) {
+    size_t begin = line.find_first_not_of(" \t");
+    if (begin == std::string::npos || line[begin] == '#') continue;
+    size_t end = line.find_first_of(" \t", begin);
+    SimPoint point = {line.substr(begin, end - begin), 1.0, {0, 0, false}, false};
+    if (end != std::string::npos) point.weight = atof(line.c_str() + end);
+    points.push_back(point);
+  }
+  return points;
+}
+
+static std::string json_escape(const std::string& str) {
+  std::string ret;
+  for (char c : str) {
+    if (c == '"' || c == '\\') ret += std::string("\\") + c;
+    else if ((unsigned char)c < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      ret += buf;
+    } else ret += c;
+  }
+  return ret;
+}
+
+static void write_simpoint_report(const char* reportname, std::vector<SimPoint>& points) {
+  FILE* fp = reportname ? fopen(reportname, "w") : stdout;
+  if (!fp) {
+    printf("Can't open %s\n", reportname);
+    fp = stdout;
+  }
+  double totalWeight = 0, weightedCPI = 0;
+  fprintf(fp, "{\n  \"checkpoints\": [\n");
+  for (size_t i = 0; i < points.size(); i ++) {
+    SimPoint& point = points[i];
+    bool valid = point.done && point.result.warmed && point.result.instrs != 0;
+    double ipc = valid ? (double)point.result.instrs / point.result.cycles : 0;
+    fprintf(fp, "    {\"path\": \"%s\", \"weight\": %lf, \"valid\": %s, \"cycleCnt\": %lu, \"instrCnt\": %lu, \"ipc\": %lf}%s\n",
+            json_escape(point.path).c_str(), point.weight, valid ? "true" : "false", point.result.cycles, point.result.instrs, ipc,
+            i + 1 == points.size() ? "" : ",");
+    if (valid) {
+      totalWeight += point.weight;
+      weightedCPI += point.weight * point.result.cycles / point.result.instrs;
+    }
+  }
+  weightedCPI = totalWeight == 0 ? 0 : weightedCPI / totalWeight;
+  fprintf(fp, "  ],\n  \"totalWeight\": %lf,\n  \"weightedCPI\": %lf,\n  \"weightedIPC\": %lf\n}\n",
+          totalWeight, weightedCPI, weightedCPI == 0 ? 0 : 1 / weightedCPI);
+  if (fp != stdout) fclose(fp);
+}
+
+static int run_simpoints(const char* gcptname, const char* listname, int jobs, const char* reportname) {
+  std::vector<SimPoint> points = read_simpoint_list(listname);
+  std::map<pid_t, std::pair<size_t, int>> workers; // pid -> (checkpoint, result pipe)
+  std::map<pid_t, std::pair<size_t, int>> loaders; // pid -> (checkpoint, image memfd)
+  std::deque<std::pair<size_t, int>> loaded;       // (checkpoint, image memfd) waiting for a worker
+  size_t next = 0;
+  int failed = 0;
+  /* a child keeps only its own image, the other memfds are released when the parent closes them */
+  auto close_inherited = [&]() {
+    for (auto iter : workers) close(iter.second.second);
+    for (auto iter : loaders) close(iter.second.second);
+    for (auto iter : loaded) close(iter.second);
+  };
+  auto start = std::chrono::system_clock::now();
+  new_models();
+  while (next < points.size() || !loaders.empty() || !loaded.empty() || !workers.empty()) {
+    if (!loaded.empty() && (int)workers.size() < jobs) {
+      size_t idx = loaded.front().first;
+      int mem_fd = loaded.front().second;
+      loaded.pop_front();
+      int fds[2];
+      if (pipe(fds) != 0) {
+        printf("Couldn't create pipe\n");
+        exit(EXIT_FAILURE);
+      }
+      fflush(stdout);
+      pid_t pid = fork();
+      if (pid == 0) {
+        close(fds[0]);
+        close_inherited();
+        std::string logname = std::string(reportname ? reportname : "simpoint") + "." + std::to_string(idx) + ".log";
+        int logfd = open(logname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (logfd != -1) {
+          dup2(logfd, STDOUT_FILENO);
+          dup2(logfd, STDERR_FILENO);
+          close(logfd);
+        }
+        CheckpointResult result = run_checkpoint(mem_fd);
+        fflush(stdout);
+        bool ret = write(fds[1], &result, sizeof(result)) == sizeof(result);
+        _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
+      }
+      close(fds[1]);
+      close(mem_fd);
+      if (pid == -1) {
+        printf("Couldn't fork for %s\n", points[idx].path.c_str());
+        exit(EXIT_FAILURE);
+      }
+      workers[pid] = std::make_pair(idx, fds[0]);
+      printf("[simpoint] start %s (%ld/%ld)\n", points[idx].path.c_str(), idx + 1, points.size());
+      continue;
+    }
+    if (next < points.size() && (int)(loaders.size() + loaded.size()) < jobs) {
+      int mem_fd = create_sim_mem();
+      fflush(stdout);
+      pid_t pid = fork();
+      if (pid == 0) {
+        close_inherited();
+        bool ret = load_sim_mem(mem_fd, points[next].path.c_str(), gcptname);
+        fflush(stdout);
+        _exit(ret ? EXIT_SUCCESS : EXIT_FAILURE);
+      }
+      if (pid == -1) {
+        printf("Couldn't fork to load %s\n", points[next].path.c_str());
+        exit(EXIT_FAILURE);
+      }
+      loaders[pid] = std::make_pair(next, mem_fd);
+      next ++;
+      continue;
+    }
+    int status;
+    pid_t pid = wait(&status);
+    if (pid == -1) continue;
+    bool success = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    if (loaders.find(pid) != loaders.end()) {
+      size_t idx = loaders[pid].first;
+      int mem_fd = loaders[pid].second;
+      loaders.erase(pid);
+      if (success) loaded.push_back(std::make_pair(idx, mem_fd));
+      else {
+        close(mem_fd);
+        failed ++;
+        printf("[simpoint] FAIL %s: can not load the image\n", points[idx].path.c_str());
+      }
+      continue;
+    }
+    if (workers.find(pid) == workers.end()) continue;
+    SimPoint& point = points[workers[pid].first];
+    int fd = workers[pid].second;
+    point.done = success && read(fd, &point.result, sizeof(point.result)) == sizeof(point.result);
+    close(fd);
+    workers.erase(pid);
+    if (!point.done) failed ++;
+    printf("[simpoint] %s %s: cycleCnt %lu instrCnt %lu\n", point.done ? "finish" : "FAIL",
+           point.path.c_str(), point.result.cycles, point.result.instrs);
+  }
+  auto dur = std::chrono::system_clock::now() - start;
+  printf("[simpoint] %ld checkpoints (%d failed) with %d jobs in %ld ms\n", points.size(), failed, jobs,
+         std::chrono::duration_cast<std::chrono::milliseconds>(dur).count());
+  write_simpoint_report(reportname, points);
+  return failed == 0 ? 0 : -1;
+}
+
+int main(int argc, char** argv) {
+  int jobs = 0;
+  const char* reportname = NULL;
+  int argi = 1;
+  for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi ++) {
+    if (strncmp(argv[argi], "--jobs=", 7) == 0) jobs = atoi(argv[argi] + 7);
+    else if (strncmp(argv[argi], "--report=", 9) == 0) reportname = argv[argi] + 9;
+    else {
+      printf("Unknown option %s\n", argv[argi]);
+      return -1;
+    }
+  }
+  if (argc - argi != 2) {
+    printf("Usage: %s <gcpt> <checkpoint>\n", argv[0]);
+    printf("       %s --jobs=N [--report=file.json] <gcpt> <checkpoint-list>\n", argv[0]);
+    return -1;
+  }
+  if (jobs > 0) return run_simpoints(argv[argi], argv[argi + 1], jobs, reportname);
+  new_models();
+  int mem_fd;
+  if (!init_sim_mem(mem_fd, argv[argi + 1], argv[argi])) return -1;
+  run_checkpoint(mem_fd);
   return 0;
 }
@@ -1,6 +1,7 @@
 #include <iostream>
 #include <time.h>
 #include <cstring>
+#include <string>
 #include <cassert>
 #include <vector>
 #include <numeric>
@@ -113,18 +114,35 @@ void dut_init(DUT_NAME *dut) {
 #endif
 }
 
+#ifdef GSIM_LANES
+/* the uart output of every lane is printed by lines with the lane number */
+static std::string uart_line[GSIM_LANES];
+static void uart_putc(int lane, char ch) {
+  uart_line[lane] += ch;
+  if (ch != '\n') return;
+  printf("[lane %d] %s", lane, uart_line[lane].c_str());
+  fflush(stdout);
+  uart_line[lane].clear();
+}
+#define DUT_LANES GSIM_LANES
+#define LANE_ARG lane
+#else
+static void uart_putc(int lane, char ch) {
+  printf("%c", ch);
+  fflush(stdout);
+}
+#define DUT_LANES 1
+#define LANE_ARG
+#endif
+
 void dut_hook(DUT_NAME *dut) {
+  for (int lane = 0; lane < DUT_LANES; lane ++) {
 #if defined(__DUT_NutShell__)
-  if (dut->get_difftest$$uart$$out$$valid()) {
-    printf("%c", dut->get_difftest$$uart$$out$$ch());
-    fflush(stdout);
-  }
+    if (dut->get_difftest$$uart$$out$$valid(LANE_ARG)) uart_putc(lane, dut->get_difftest$$uart$$out$$ch(LANE_ARG));
 #elif defined(__DUT_minimal_xiangshan__) || defined(__DUT_default_xiangshan__)
-  if (dut->get_difftest$$uart$$out$$valid()) {
-    printf("%c", dut->get_difftest$$uart$$out$$ch());
-    fflush(stdout);
-  }
+    if (dut->get_difftest$$uart$$out$$valid(LANE_ARG)) uart_putc(lane, dut->get_difftest$$uart$$out$$ch(LANE_ARG));
 #endif
+  }
 }
 #endif
 
@@ -226,6 +244,19 @@ static void close_program() {
 void dut_cycle(int n) { while (n --) dut->step(); }
 void dut_reset() { dut->set_reset(1); dut_cycle(10); dut->set_reset(0); }
 #endif
+#ifdef PERF
+/* the model is emitted with --instrument-activity, the profile feeds --activity-profile
+   it is written once when the simulation ends */
+static void report_activity() {
+  uint64_t samples = dut->activitySampledCycles();
+  if (samples == 0) return;
+  uint64_t activations = 0;
+  for (size_t i = 0; i < dut->activityNum(); i ++) activations += dut->activityCount(i);
+  printf("[activity] %ld superNodes, %.2lf activated per cycle in %ld sampled cycles\n",
+      dut->activityNum(), (double)activations / samples, samples);
+  dut->writeActivityProfile(ACTIVITY_FILE);
+}
+#endif
 #ifdef VERILATOR
 void ref_cycle(int n) {
   while (n --) {
@@ -248,12 +279,25 @@ bool checkSignals(bool display) {
 #endif
 
 int main(int argc, char** argv) {
-  load_program(argv[1]);
 #ifdef GSIM
   dut = new DUT_NAME();
+#ifdef GSIM_LANES
+  /* lane i runs the program argv[1 + i % (argc - 1)] */
+  for (int lane = GSIM_LANES - 1; lane > 0; lane --) {
+    load_program(argv[1 + lane % (argc - 1)]);
+    memcpy(&dut->DUT_MEMORY[lane], program, program_sz);
+    close_program();
+  }
+  load_program(argv[1]);
+  memcpy(&dut->DUT_MEMORY[0], program, program_sz);
+#else
+  load_program(argv[1]);
   memcpy(&dut->DUT_MEMORY, program, program_sz);
+#endif
   dut_init(dut);
   dut_reset();
+#else
+  load_program(argv[1]);
 #endif
 #ifdef VERILATOR
   ref = new REF_NAME();
@@ -273,9 +317,6 @@ int main(int argc, char** argv) {
   std::signal(SIGINT, [](int){ dut_end = true; });
   std::signal(SIGTERM, [](int){ dut_end = true; });
   uint64_t cycles = 0;
-#ifdef PERF
-  FILE* activeFp = fopen(ACTIVE_FILE, "w");
-#endif
   auto start = std::chrono::system_clock::now();
   while (!dut_end) {
 #if defined(GSIM)
@@ -306,38 +347,13 @@ int main(int argc, char** argv) {
       auto msec = std::chrono::duration_cast<std::chrono::milliseconds>(dur);
       fprintf(stderr, "cycles %ld (%ld ms, %ld per sec) simulation process %.2lf%% \n",
           cycles, msec.count(), cycles * 1000 / msec.count(), (double)cycles * 100 / CYCLE_MAX_SIM);
-#ifdef PERF
-      size_t totalActives = 0;
-      size_t validActives = 0;
-      size_t nodeActives = 0;
-      for (size_t i = 0; i < sizeof(dut->activeTimes) / sizeof(dut->activeTimes[0]); i ++) {
-        totalActives += dut->activeTimes[i];
-        validActives += dut->validActive[i];
-        nodeActives += dut->nodeNum[i] * dut->activeTimes[i];
-      }
-      printf("nodeNum %ld totalActives %ld activePerCycle %ld totalValid %ld validPerCycle %ld nodeActive %ld\n",
-          nodeNum, totalActives, totalActives / cycles, validActives, validActives / cycles, nodeActives);
-      fprintf(activeFp, "totalActives %ld activePerCycle %ld totalValid %ld validPerCycle %ld\n",
-          totalActives, totalActives / cycles, validActives, validActives / cycles);
-      for (size_t i = 1; i < sizeof(dut->activeTimes) / sizeof(dut->activeTimes[0]); i ++) {
-        fprintf(activeFp, "%ld: activeTimes %ld validActive %ld\n", i, dut->activeTimes[i], dut->validActive[i]);
-      }
-
-      std::ofstream out("data/active/activeTimes" + std::to_string(cycles / 10000000) + ".txt");
-      std::vector<uint64_t> activeTimes(dut->allActiveTimes);
-      std::vector<uint64_t> sorted = sort_indexes(activeTimes);
-      out << "posActives " << dut->posActivate << " " << dut->posActivate / cycles << " actives " << dut->activeNum / cycles << std::endl;
-      out << "funcTime " << dut->funcTime << " activeTime " << dut->activeTime << " regsTime " << dut->regsTime << " memoryTime " << dut->memoryTime << std::endl;
-      for (int i = sorted.size()-1; i >= 0; i --) {
-        if (dut->allNames[sorted[i]].length() == 0) continue;
-        out << dut->allNames[sorted[i]] << " " << dut->nodeNum[sorted[i]] << " " << (double)activeTimes[sorted[i]] / cycles << " " << activeTimes[sorted[i]] << " " \
-            << dut->posActives[sorted[i]] << " "  << (double)dut->posActives[sorted[i]] / activeTimes[sorted[i]] << std::endl;
-      }
-#endif
 #if defined(PERF) || defined(PERF_CYCLE)
-      if (cycles >= CYCLE_MAX_PERF) return 0;
+      if (cycles >= CYCLE_MAX_PERF) break;
 #endif
-      if (cycles == CYCLE_MAX_SIM) return 0;
+      if (cycles == CYCLE_MAX_SIM) break;
     }
   }
+#ifdef PERF
+  report_activity();
+#endif
 }
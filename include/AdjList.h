@@ -0,0 +1,68 @@
+/**
+ * @file AdjList.h
+ * @brief adjacency lists of nodes and superNodes
+ */
+
+#ifndef ADJLIST_H
+#define ADJLIST_H
+
+/*
+  set of adjacent nodes stored in a contiguous array sorted by the dense id of the nodes,
+  used for edges instead of std::set<T*>: iteration walks sequential memory and its order
+  is deterministic (std::set<T*> is ordered by pointer values)
+  the interface is the subset of std::set used by the passes, so edges can still be edited
+  in place; inserting or erasing invalidates the iterators of the same list
+*/
+template <typename T>
+class AdjList {
+  std::vector<T*> elems;
+  static bool idLess(const T* a, const T* b) { return a->id < b->id; }
+public:
+  typedef typename std::vector<T*>::const_iterator iterator;
+  typedef iterator const_iterator;
+
+  AdjList() {}
+  AdjList(const std::set<T*>& other) { insert(other.begin(), other.end()); }
+  template <typename It> AdjList(It first, It last) { insert(first, last); }
+  operator std::set<T*>() const { return std::set<T*>(elems.begin(), elems.end()); }
+
+  bool operator==(const AdjList<T>& other) const { return elems == other.elems; }
+  bool operator!=(const AdjList<T>& other) const { return elems != other.elems; }
+
+  iterator begin() const { return elems.begin(); }
+  iterator end() const { return elems.end(); }
+  size_t size() const { return elems.size(); }
+  bool empty() const { return elems.empty(); }
+  void clear() { elems.clear(); elems.shrink_to_fit(); }
+  void reserve(size_t num) { elems.reserve(num); }
+
+  iterator find(T* x) const {
+    iterator iter = std::lower_bound(elems.begin(), elems.end(), x, idLess);
+    return (iter != elems.end() && *iter == x) ? iter : elems.end();
+  }
+  size_t count(T* x) const { return find(x) == end() ? 0 : 1; }
+
+  std::pair<iterator, bool> insert(T* x) {
+    /* edges are mostly added in the order of node creation */
+    if (elems.empty() || idLess(elems.back(), x)) {
+      elems.push_back(x);
+      return std::make_pair(elems.end() - 1, true);
+    }
+    auto iter = std::lower_bound(elems.begin(), elems.end(), x, idLess);
+    if (*iter == x) return std::make_pair(iterator(iter), false);
+    return std::make_pair(iterator(elems.insert(iter, x)), true);
+  }
+  template <typename It> void insert(It first, It last) {
+    for (; first != last; first ++) insert(*first);
+  }
+
+  size_t erase(T* x) {
+    iterator iter = find(x);
+    if (iter == end()) return 0;
+    elems.erase(iter);
+    return 1;
+  }
+  iterator erase(iterator iter) { return elems.erase(iter); }
+};
+
+#endif
@@ -115,14 +115,14 @@ class Node {
   int orderInSuper = -1;
   int lineno = -1;
   /* adjacent */
-  std::set<Node*> next;
-  std::set<Node*> prev;
+  AdjList<Node> next;
+  AdjList<Node> prev;
   /* dependent but not adjacent
    * e.g. reg_src -> node1; node2->reg_dst; then:
    * node1 is depPrev of reg_dst, as activeFlags of node1 must first be cleared before reg_dst is activated
   */
-  std::set<Node*> depPrev;
-  std::set<Node*> depNext;
+  AdjList<Node> depPrev;
+  AdjList<Node> depNext;
   std::vector <ExpTree*> assignTree;
   SuperNode* super = nullptr;
   std::vector<Node*> member;
@@ -261,12 +261,14 @@ class Node {
   void clear_relation();
   void addPrev(Node* node);
   void addPrev(std::set<Node*>& super);
+  void addPrev(AdjList<Node>& super);
   void addPrev(std::vector<Node*>& super);
   void erasePrev(Node* node);
   void addDepPrev(Node* node);
   void eraseDepPrev(Node* node);
   void addNext(Node* node);
   void addNext(std::set<Node*>& super);
+  void addNext(AdjList<Node>& super);
   void addNext(std::vector<Node*>& super);
   void eraseNext(Node* node);
   void addDepNext(Node* node);
@@ -361,11 +363,11 @@ private:
   static int counter;  // initialize to 1
 public:
   /* adjacent superNodes */
-  std::set<SuperNode*> prev;
-  std::set<SuperNode*> next;
+  AdjList<SuperNode> prev;
+  AdjList<SuperNode> next;
   /* dependent but not adjacent */
-  std::set<SuperNode*> depPrev;
-  std::set<SuperNode*> depNext;
+  AdjList<SuperNode> depPrev;
+  AdjList<SuperNode> depNext;
   std::vector<Node*> member; // The order of member is neccessary
   std::vector<InstInfo> insts;
   StmtTree* stmtTree = nullptr;
@@ -374,6 +376,11 @@ public:
   int cppId = -1;
   SuperType superType = SUPER_VALID;
   Node* resetNode = nullptr;
+  /* used in threaded cppEmitter */
+  int threadId = 0;
+  int threadPos = 0;          // 1-based position in the task list of threadId
+  bool threadPublish = false; // other threads wait for the completion of this superNode
+  std::vector<std::pair<int, int>> threadWait; // <thread, pos> to wait for before evaluation
   SuperNode() {
     id = counter ++;
   }
@@ -395,6 +402,8 @@ public:
     _next->addPrev(this);
   }
   bool instsEmpty();
+  bool hasCode();
+  bool isSerial();
   void display();
   int findIndex(Node* node) {
     for (size_t ret = 0; ret < member.size(); ret ++) {
@@ -407,11 +416,13 @@ public:
   void clear_relation();
   void addPrev(SuperNode* super);
   void addPrev(std::set<SuperNode*>& super);
+  void addPrev(AdjList<SuperNode>& super);
   void erasePrev(SuperNode* super);
   void addDepPrev(SuperNode* super);
   void eraseDepPrev(SuperNode* super);
   void addNext(SuperNode* super);
   void addNext(std::set<SuperNode*>& super);
+  void addNext(AdjList<SuperNode>& super);
   void eraseNext(SuperNode* super);
   void eraseDepNext(SuperNode* super);
   void addDepNext(SuperNode* super);
@@ -0,0 +1,14 @@
+#ifndef ACTIVITY_H
+#define ACTIVITY_H
+
+/* per-cycle activation and change rates of a node, recorded by a previous run */
+struct NodeActivity {
+  double activeRate;
+  double changeRate;
+};
+
+void loadActivityProfile(std::string path);
+bool hasActivityProfile();
+NodeActivity nodeActivity(Node* node);
+
+#endif
@@ -21,9 +21,7 @@
 #include <gmp.h>
 #include <cstdarg>
 
-#define NR_THREAD 10
 #define ORDERED_TOPO_SORT
-// #define PERF
 
 #define LENGTH(a) (sizeof(a) / sizeof(a[0]))
 
@@ -124,6 +122,7 @@ enum ResetType { UNCERTAIN, ASYRESET, UINTRESET, ZERO_RESET };
 
 #include "opFuncs.h"
 #include "debug.h"
+#include "AdjList.h"
 #include "Node.h"
 #include "PNode.h"
 #include "ExpTree.h"
@@ -132,6 +131,7 @@ enum ResetType { UNCERTAIN, ASYRESET, UINTRESET, ZERO_RESET };
 #include "util.h"
 #include "valInfo.h"
 #include "perf.h"
+#include "activity.h"
 #include "config.h"
 
 #define TIMER_START(name) struct timeval CONCAT(__timer_, name) = getTime();
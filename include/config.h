@@ -15,7 +15,27 @@ struct Config {
   int MergeWhenSize;
   int When2muxBound;
   int LogLevel;
+  int ThreadNum;
+  int ActiveWidth;
+  int Lanes;
+  int ParserJobs;
   std::set<std::string> DumpStages;
+  std::string StatsJson;
+  std::string ActivityProfile;
+  bool InstrumentActivity;
+  double AlwaysActiveRatio;
+  double ColdRatio;
+  bool ActiveLocality;
+  bool StateLayout;
+  int SparseMemoryKB;
+  bool WideKernels;
+  bool SkipIdle;
+  std::vector<std::string> PureExtModules;
+  std::vector<std::string> WatchOutputs;
+  bool LazyOutputs;
+  std::string PortManifest;
+  int LutMaxBits;
+  bool PackBits;
   Config();
 };
 
@@ -11,6 +11,8 @@ class graph {
   int srcFileBytes;
 
   bool __emitSrc(int indent, bool canNewFile, bool alreadyEndFunc, const char *nextFuncDef, const char *fmt, ...);
+  void beginLaneBlock();
+  void endLaneBlock(int indent, bool loop);
   void emitPrintf();
   void activateNext(Node* node, std::set<int>& nextNodeId, std::string oldName, bool inStep, std::string flagName, int indent);
   void activateUncondNext(Node* node, std::set<int>& activateId, bool inStep, std::string flagName, int indent);
@@ -27,10 +29,24 @@ class graph {
   void nodeDisplay(Node* member, int indent);
   void genMemRead(FILE* fp);
   int genActivate();
+  void genThreadActivate(std::vector<int>& subStepNum);
+  void genThreadStep(std::vector<int>& subStepNum);
+  void threadPartition(std::vector<SuperNode*>& emitSuper);
   void genUpdateRegister(FILE* fp);
   void genMemWrite(FILE* fp);
   void saveDiffRegs();
   void genResetAll();
+  void genStateSnapshot(FILE* header);
+  void genStateLayout(FILE* header);
+  void genSparseMemory(FILE* header);
+  void genSkipIdle(FILE* header);
+  void genRun(FILE* header);
+  void genActivityProfile(FILE* header);
+  void selectAlwaysActive();
+  void selectColdSuper();
+  void genColdSuper(FILE* header);
+  void selectLazySuper();
+  void genLazySuper(FILE* header);
   void genResetDef(SuperNode* super, bool isUIntReset, int indent);
   void genResetActivation(SuperNode* super, bool isUIntReset, int indent, int resetId);
   void genResetDecl(FILE* fp);
@@ -54,6 +70,7 @@ class graph {
   void genDiffSig(FILE* fp, Node* node);
   void graphCoarsen();
   void graphInitPartition();
+  void activityPartition(std::vector<int>& b);
   void graphRefine();
   void resort();
   void detectSortedSuperLoop();
@@ -73,6 +90,8 @@ class graph {
   /* used after toposort */
   std::vector<SuperNode*> sortedSuper;
   std::vector<SuperNode*> allReset;
+  /* task lists of every thread in threaded mode, each in cppId order */
+  std::vector<std::vector<SuperNode*>> threadTasks;
   std::vector<std::string> extDecl;
   std::string name;
   int nodeNum = 0;
@@ -82,6 +101,11 @@ class graph {
   void detectLoop();
   void topoSort();
   void instsGenerator();
+  void splitOutputCones();
+  void applyPortManifest(std::string path);
+  void splitLutCones();
+  void lutMemoize();
+  void activeLocalityOrder();
   void cppEmitter();
   void usedBits();
   void traversal();
@@ -90,6 +114,7 @@ class graph {
   void removeDeadNodes();
   void aliasAnalysis();
   size_t countNodes();
+  void countGraph(size_t& nodeNum, size_t& superNum, size_t& edgeNum);
   void removeEmptySuper();
   void removeNodes(NodeStatus status);
   void mergeRegister();
@@ -99,6 +124,7 @@ class graph {
   void commonExpr();
   void splitNodes();
   void replicationOpt();
+  void packBits();
   void perfAnalysis();
   void exprOpt();
   void patternDetect();
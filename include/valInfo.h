@@ -2,6 +2,7 @@
 #define VALINFO_H
 
 std::string legalCppCons(std::string str);
+std::string mpzHexStr(mpz_t& val);
 int upperPower2(int x);
 
 enum valStatus {
@@ -14,8 +15,6 @@ enum valStatus {
 };
 enum valType {TYPE_NORMAL = 0, TYPE_ARRAY, TYPE_STMT};
 class valInfo {
-private:
-  mpz_t mask;
 public:
   std::string valStr;
   int opNum = 0;
@@ -35,20 +34,33 @@ public:
 
   valInfo(int _width = 0, bool _sign = 0) {
     mpz_init(consVal);
-    mpz_init(mask);
     mpz_init(assignmentCons);
     width = _width;
     sign = _sign;
     typeWidth = upperPower2(_width);
   }
+  /* non-negative constants of at most 64 bits, which take the uint64_t paths */
+  bool consFitsU64() { return mpz_sgn(consVal) >= 0 && mpz_sizeinbase(consVal, 2) <= 64; }
   void setConsStr() {
-    if (mpz_sgn(consVal) >= 0) {
-      valStr = mpz_get_str(NULL, 16, consVal);
+    if (consFitsU64()) {
+      char buf[20];
+      snprintf(buf, sizeof(buf), "%lx", mpz_get_ui(consVal));
+      valStr = buf;
+    } else if (mpz_sgn(consVal) < 0 && widthBits(width) <= 64 && mpz_fits_slong_p(consVal)) {
+      int bits = widthBits(width);
+      uint64_t val = (uint64_t)mpz_get_si(consVal);
+      if (bits < 64) val &= (1UL << bits) - 1;
+      char buf[20];
+      snprintf(buf, sizeof(buf), "%lx", val);
+      valStr = buf;
+    } else if (mpz_sgn(consVal) >= 0) {
+      valStr = mpzHexStr(consVal);
     } else {
       mpz_t sintVal;
       mpz_init(sintVal);
       u_asUInt(sintVal, consVal, widthBits(width));
-      valStr = mpz_get_str(NULL, 16, sintVal);
+      valStr = mpzHexStr(sintVal);
+      mpz_clear(sintVal);
     }
     consLength = valStr.length();
     if (valStr.length() <= 16) valStr = (sign ? Cast(width, sign) : "") + "0x" + valStr;
@@ -59,10 +71,11 @@ public:
     opNum = 0;
   }
   void updateConsVal() {
-    mpz_set_ui(mask, 1);
-    mpz_mul_2exp(mask, mask, width);
-    mpz_sub_ui(mask, mask, 1);
-    mpz_and(consVal, consVal, mask);
+    if (width < 64 && consFitsU64()) {
+      mpz_set_ui(consVal, mpz_get_ui(consVal) & ((1UL << width) - 1));
+    } else if (width != 64 || !consFitsU64()) {
+      mpz_fdiv_r_2exp(consVal, consVal, width);
+    }
     if (sign) {
       s_asSInt(consVal, consVal, width);
     }
@@ -11,6 +11,8 @@
 #endif
 
 #include <stack>
+#include <cstring>
+#include <algorithm>
 #include "PNode.h"
 
 namespace Parser {
@@ -24,6 +26,11 @@ public:
     yyFlexLexer(arg_yyin, arg_yyout) {
     indentLevels.push(0);
   }
+  /* scan [buf, buf + len) in place, without copying it into an istream */
+  Lexical(const char* buf, size_t len) : Lexical() {
+    inputPtr = buf;
+    inputEnd = buf + len;
+  }
   int lex(Syntax::semantic_type* yylval);
   int lex_debug(Syntax::semantic_type* yylval);
   void set_lineno(int n) { yylineno = n; }
@@ -34,6 +41,15 @@ protected:
   int bracket_num = 0;
   int parenthesis_num = 0;
   std::stack<int>indentLevels;
+  const char* inputPtr = NULL;
+  const char* inputEnd = NULL;
+  int LexerInput(char* buf, int max_size) override {
+    if (!inputPtr) return yyFlexLexer::LexerInput(buf, max_size);
+    size_t size = std::min((size_t)max_size, (size_t)(inputEnd - inputPtr));
+    memcpy(buf, inputPtr, size);
+    inputPtr += size;
+    return size;
+  }
 };
 
 }  // namespace Parser
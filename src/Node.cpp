@@ -337,6 +337,11 @@ void Node::addPrev(std::set<Node*>& node) {
   depPrev.insert(node.begin(), node.end());
 }
 
+void Node::addPrev(AdjList<Node>& node) {
+  prev.insert(node.begin(), node.end());
+  depPrev.insert(node.begin(), node.end());
+}
+
 void Node::addPrev(std::vector<Node*>& node) {
   prev.insert(node.begin(), node.end());
   depPrev.insert(node.begin(), node.end());
@@ -362,6 +367,11 @@ void Node::addNext(std::set<Node*>& node) {
   depNext.insert(node.begin(), node.end());
 }
 
+void Node::addNext(AdjList<Node>& node) {
+  next.insert(node.begin(), node.end());
+  depNext.insert(node.begin(), node.end());
+}
+
 void Node::addNext(std::vector<Node*>& node) {
   next.insert(node.begin(), node.end());
   depNext.insert(node.begin(), node.end());
@@ -0,0 +1,145 @@
+/*
+  activeLocality: reorder the superNodes before the cppIds are assigned, so that superNodes
+  activated by the same node share activeFlags words. Such an activation is then a single
+  masked OR, and the flag scan meets fewer non-zero words.
+  The new order is a linear extension of depPrev built by list scheduling: among the ready
+  superNodes, pick the one most often activated together with the superNodes already placed
+  in the current word
+*/
+
+#include "common.h"
+#include <map>
+
+#define LOCALITY_MAX_FANOUT 64 // activators of more superNodes touch many words anyway
+#define LOCALITY_MIN_WEIGHT 1e-3 // keep the static structure as a tie-breaker of profiled rates
+
+/* superNodes (other than its own) activated when node changes, see Node::updateActivate */
+static void activatedSupers(Node* node, std::vector<SuperNode*>& supers) {
+  for (Node* nextNode : node->next) {
+    if (nextNode->super != node->super) supers.push_back(nextNode->super);
+  }
+  if (node->type == NODE_REG_DST) supers.push_back(node->getSrc()->super);
+  if (node->type == NODE_WRITER || node->type == NODE_READWRITER) {
+    for (Node* port : node->parent->member) {
+      if (port != node && port->status == VALID_NODE && (port->type == NODE_READER || port->type == NODE_READWRITER))
+        supers.push_back(port->super);
+    }
+  }
+  std::sort(supers.begin(), supers.end(), [](SuperNode* a, SuperNode* b) { return a->id < b->id; });
+  supers.erase(std::unique(supers.begin(), supers.end()), supers.end());
+  supers.erase(std::remove(supers.begin(), supers.end(), node->super), supers.end());
+}
+
+/* average number of activeFlags words written by an activation */
+static double wordsPerActivation(std::vector<int>& order, std::vector<bool>& hasCode, std::vector<std::vector<int>>& activations) {
+  if (activations.empty()) return 0;
+  std::vector<int> id(order.size(), -1);
+  int cppId = 0;
+  for (int idx : order) {
+    if (hasCode[idx]) id[idx] = cppId ++;
+  }
+  size_t words = 0;
+  for (std::vector<int>& supers : activations) {
+    std::set<int> activeWords;
+    for (int idx : supers) activeWords.insert(id[idx] / globalConfig.ActiveWidth);
+    words += activeWords.size();
+  }
+  return (double)words / activations.size();
+}
+
+void graph::activeLocalityOrder() {
+  int num = sortedSuper.size();
+  std::map<SuperNode*, int> pos;
+  for (int i = 0; i < num; i ++) pos[sortedSuper[i]] = i;
+  std::vector<bool> hasCode(num);
+  for (int i = 0; i < num; i ++) hasCode[i] = sortedSuper[i]->hasCode();
+
+  std::vector<int> inDegree(num, 0);
+  std::vector<std::vector<int>> succ(num);
+  for (int i = 0; i < num; i ++) {
+    for (SuperNode* prev : sortedSuper[i]->depPrev) {
+      succ[pos[prev]].push_back(i);
+      inDegree[i] ++;
+    }
+  }
+  /* printf, assert and extmodules keep their sequential order */
+  int prevSerial = -1;
+  for (int i = 0; i < num; i ++) {
+    if (!hasCode[i] || !sortedSuper[i]->isSerial()) continue;
+    if (prevSerial >= 0) {
+      succ[prevSerial].push_back(i);
+      inDegree[i] ++;
+    }
+    prevSerial = i;
+  }
+
+  /* activations of at least two emitted superNodes, weighted by the change rate of the activator if profiled */
+  std::vector<std::vector<int>> activations;
+  std::vector<double> weight;
+  std::vector<std::vector<int>> activatedBy(num);
+  for (SuperNode* super : sortedSuper) {
+    for (Node* member : super->member) {
+      if (member->status != VALID_NODE) continue;
+      std::vector<SuperNode*> supers;
+      activatedSupers(member, supers);
+      std::vector<int> activated;
+      for (SuperNode* activatedSuper : supers) {
+        if (hasCode[pos[activatedSuper]]) activated.push_back(pos[activatedSuper]);
+      }
+      if (activated.size() < 2 || activated.size() > LOCALITY_MAX_FANOUT) continue;
+      for (int idx : activated) activatedBy[idx].push_back(activations.size());
+      activations.push_back(activated);
+      weight.push_back(hasActivityProfile() ? MAX(nodeActivity(member).changeRate, LOCALITY_MIN_WEIGHT) : 1);
+    }
+  }
+
+  std::set<int> ready, readyEmpty;
+  for (int i = 0; i < num; i ++) {
+    if (inDegree[i] == 0) (hasCode[i] ? ready : readyEmpty).insert(i);
+  }
+  std::vector<int> order;
+  std::map<int, double> affinity; // affinity of the unplaced superNodes to the current word
+  int filled = 0;
+  while (!ready.empty() || !readyEmpty.empty()) {
+    int pick;
+    if (!readyEmpty.empty()) { // superNodes without code take no flag, release their successors first
+      pick = *readyEmpty.begin();
+      readyEmpty.erase(readyEmpty.begin());
+    } else {
+      pick = *ready.begin();
+      double best = 0;
+      for (auto iter : affinity) {
+        if (iter.second > best && ready.find(iter.first) != ready.end()) {
+          best = iter.second;
+          pick = iter.first;
+        }
+      }
+      ready.erase(pick);
+      affinity.erase(pick);
+      if (++ filled % globalConfig.ActiveWidth == 0) affinity.clear();
+      else {
+        for (int act : activatedBy[pick]) {
+          for (int idx : activations[act]) {
+            if (idx != pick && inDegree[idx] >= 0) affinity[idx] += weight[act];
+          }
+        }
+      }
+    }
+    order.push_back(pick);
+    inDegree[pick] = -1;
+    for (int next : succ[pick]) {
+      if (-- inDegree[next] == 0) (hasCode[next] ? ready : readyEmpty).insert(next);
+    }
+  }
+  Assert((int)order.size() == num, "activeLocality: %ld of %d superNodes are ordered", order.size(), num);
+
+  std::vector<int> origin(num);
+  for (int i = 0; i < num; i ++) origin[i] = i;
+  double before = wordsPerActivation(origin, hasCode, activations);
+  double after = wordsPerActivation(order, hasCode, activations);
+  printf("[activeLocality] %ld activations, activeFlags words per activation %.3lf -> %.3lf\n", activations.size(), before, after);
+  if (after >= before) return;
+  std::vector<SuperNode*> newSorted;
+  for (int idx : order) newSorted.push_back(sortedSuper[idx]);
+  sortedSuper = newSorted;
+}
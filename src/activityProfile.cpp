@@ -0,0 +1,133 @@
+/*
+  activityProfile: activation and change counts of nodes recorded by a previous run
+  text format, one entry per line ('#' starts a comment):
+    cycles <num>
+    <node name> <activations> <changes>
+  binary format: written by writeActivityProfile() of a model emitted with --instrument-activity,
+    GSIMActivityHeader followed by {uint64_t count; uint32_t nameLen; char names[nameLen];} for every superNode,
+    names are the space-separated members of the superNode. It has no change counts.
+*/
+
+#include "common.h"
+#include <fstream>
+#include <tuple>
+#include <unordered_map>
+
+#define ACTIVITY_MAGIC "GSIMACTV"
+#define UNKNOWN_RATE -1.0
+
+static std::unordered_map<std::string, NodeActivity> profile;
+static bool profileLoaded = false;
+
+static void setActivity(const std::string& name, uint64_t activations, double changeRate, uint64_t cycles) {
+  NodeActivity activity;
+  activity.activeRate = MIN(1.0, (double)activations / cycles);
+  activity.changeRate = changeRate;
+  profile[name] = activity;
+}
+
+static uint64_t loadTextProfile(std::string path) {
+  std::ifstream in(path);
+  Assert(in.is_open(), "cannot open activity profile %s", path.c_str());
+  uint64_t cycles = 0;
+  std::vector<std::tuple<std::string, uint64_t, uint64_t>> entries;
+  std::string line;
+  int lineno = 0;
+  while (std::getline(in, line)) {
+    lineno ++;
+    size_t comment = line.find('#');
+    if (comment != std::string::npos) line.erase(comment);
+    std::istringstream ss(line);
+    std::string name;
+    if (!(ss >> name)) continue;
+    uint64_t activations, changes;
+    Assert(ss >> activations, "%s:%d: expect <name> <activations> <changes>", path.c_str(), lineno);
+    /* a node may also be named cycles, which has two counts */
+    if (!(ss >> changes)) {
+      Assert(name == "cycles", "%s:%d: expect <name> <activations> <changes>", path.c_str(), lineno);
+      cycles = activations;
+      continue;
+    }
+    entries.push_back(std::make_tuple(name, activations, changes));
+  }
+  Assert(cycles > 0, "activity profile %s does not record cycles", path.c_str());
+  for (auto& entry : entries) {
+    setActivity(std::get<0>(entry), std::get<1>(entry), MIN(1.0, (double)std::get<2>(entry) / cycles), cycles);
+  }
+  return cycles;
+}
+
+static uint64_t loadBinaryProfile(std::string path) {
+  std::ifstream in(path, std::ios::binary);
+  struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t superNum;
+    uint64_t cycles;
+    uint64_t interval;
+  } header;
+  Assert(in.read((char*)&header, sizeof(header)), "%s: truncated activity profile", path.c_str());
+  Assert(header.version == 1, "%s: unsupported activity profile version %d", path.c_str(), header.version);
+  Assert(header.cycles > 0, "activity profile %s does not record cycles", path.c_str());
+  for (uint32_t i = 0; i < header.superNum; i ++) {
+    uint64_t count;
+    uint32_t nameLen;
+    Assert(in.read((char*)&count, sizeof(count)) && in.read((char*)&nameLen, sizeof(nameLen)), "%s: truncated activity profile", path.c_str());
+    std::string names(nameLen, '\0');
+    Assert(in.read(&names[0], nameLen), "%s: truncated activity profile", path.c_str());
+    std::istringstream ss(names);
+    std::string name;
+    while (ss >> name) setActivity(name, count, UNKNOWN_RATE, header.cycles);
+  }
+  return header.cycles;
+}
+
+void loadActivityProfile(std::string path) {
+  char magic[8] = {0};
+  std::ifstream in(path, std::ios::binary);
+  Assert(in.is_open(), "cannot open activity profile %s", path.c_str());
+  in.read(magic, sizeof(magic));
+  in.close();
+  uint64_t cycles = memcmp(magic, ACTIVITY_MAGIC, sizeof(magic)) == 0 ? loadBinaryProfile(path) : loadTextProfile(path);
+  profileLoaded = true;
+  printf("[activityProfile] %ld nodes in %ld cycles from %s\n", profile.size(), cycles, path.c_str());
+}
+
+bool hasActivityProfile() {
+  return profileLoaded;
+}
+
+/*
+  a node changes at most as often as it is activated, and every change activates its successors,
+  so without recorded changes, take the least active profiled successor as the bound
+*/
+static double changeRate(Node* node, const NodeActivity& activity) {
+  if (activity.changeRate != UNKNOWN_RATE) return activity.changeRate;
+  double ret = activity.activeRate;
+  for (Node* next : node->next) {
+    auto iter = profile.find(next->name);
+    if (iter != profile.end()) ret = MIN(ret, iter->second.activeRate);
+  }
+  return ret;
+}
+
+/*
+  nodes created after the profiled run (e.g. by splitNodes) are activated by their predecessors,
+  take the most active one; unknown sources are assumed to be active every cycle
+*/
+NodeActivity nodeActivity(Node* node) {
+  auto iter = profile.find(node->name);
+  if (iter != profile.end()) return {iter->second.activeRate, changeRate(node, iter->second)};
+  NodeActivity ret = {0, 0};
+  bool found = false;
+  for (Node* prev : node->prev) {
+    auto prevIter = profile.find(prev->name);
+    if (prevIter == profile.end()) continue;
+    double rate = changeRate(prev, prevIter->second);
+    ret.activeRate = MAX(ret.activeRate, rate);
+    ret.changeRate = MAX(ret.changeRate, rate);
+    found = true;
+  }
+  if (!found) ret = {1, 1};
+  return ret;
+}
@@ -69,15 +69,18 @@ static void addRecompute(Node* node) {
   }
 }
 
+/* val > 2^width - 1, compared without building the mask */
 static bool mpzOutOfBound(mpz_t& val, int width) {
-  mpz_t tmp;
-  mpz_init(tmp);
-  mpz_set_ui(tmp, 1);
-  mpz_mul_2exp(tmp, tmp, width);
-  mpz_sub_ui(tmp, tmp, 1);
-  if (mpz_cmp(val, tmp) > 0) return true;
-  return false;
+  return mpz_sgn(val) > 0 && mpz_sizeinbase(val, 2) > (size_t)width;
+}
+
+/* unsigned constants of at most 64 bits are folded with uint64_t instead of the mpz kernels */
+static bool narrowCons(valInfo* info, uint64_t& val) {
+  if (info->sign || !info->consFitsU64()) return false;
+  val = mpz_get_ui(info->consVal);
+  return true;
 }
+#define NarrowChildren(a, b) (!sign && width <= 64 && narrowCons(consEMap[getChild(0)], a) && narrowCons(consEMap[getChild(1)], b))
 
 valInfo* setENodeCons(ENode* enode, std::string str) {
   valInfo* consInfo = new valInfo(enode->width, enode->sign);
@@ -97,9 +100,7 @@ valInfo* setNodeCons(Node* node, std::string str) {
 bool cons_resetConsEq(valInfo* dstInfo, valInfo* resetInfo) {
   if (!resetInfo) return true;
   if (resetInfo->status == VAL_EMPTY) return true;
-  mpz_t consVal;
-  mpz_init(consVal);
-  mpz_set(consVal, dstInfo->status == VAL_CONSTANT ? dstInfo->consVal : dstInfo->assignmentCons);
+  mpz_t& consVal = dstInfo->status == VAL_CONSTANT ? dstInfo->consVal : dstInfo->assignmentCons;
   if (resetInfo->status == VAL_CONSTANT && mpz_cmp(resetInfo->consVal, consVal) == 0) return true;
   if (resetInfo->sameConstant && mpz_cmp(resetInfo->assignmentCons, consVal) == 0) return true;
   return false;
@@ -221,7 +222,9 @@ valInfo* ENode::consGroup(Node* node, bool isLvalue) {
 valInfo* ENode::consAdd(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
-    us_add(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (NarrowChildren(a, b)) mpz_set_ui(ret->consVal, a + b);
+    else us_add(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
   }
   return ret;
@@ -230,7 +233,9 @@ valInfo* ENode::consAdd(bool isLvalue) {
 valInfo* ENode::consSub(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
-    us_sub(ret->consVal, ChildCons(0, consVal), ChildCons(1, consVal), width);
+    uint64_t a, b;
+    if (NarrowChildren(a, b)) mpz_set_ui(ret->consVal, a - b);
+    else us_sub(ret->consVal, ChildCons(0, consVal), ChildCons(1, consVal), width);
     ret->updateConsVal();
   }
   return ret;
@@ -266,7 +271,9 @@ valInfo* ENode::consRem(bool isLvalue) {
 valInfo* ENode::consLt(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
-    us_lt(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (NarrowChildren(a, b)) mpz_set_ui(ret->consVal, a < b);
+    else us_lt(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
   } else if (!Child(0, sign) && ChildCons(1, status) == VAL_CONSTANT && mpz_sgn(ChildCons(1, consVal)) == 0) {
     ret->setConstantByStr("0");
@@ -277,7 +284,9 @@ valInfo* ENode::consLt(bool isLvalue) {
 valInfo* ENode::consLeq(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
-    us_leq(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (NarrowChildren(a, b)) mpz_set_ui(ret->consVal, a <= b);
+    else us_leq(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
   }
   return ret;
@@ -286,7 +295,9 @@ valInfo* ENode::consLeq(bool isLvalue) {
 valInfo* ENode::consGt(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
-    us_gt(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (NarrowChildren(a, b)) mpz_set_ui(ret->consVal, a > b);
+    else us_gt(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
   }
   return ret;
@@ -295,7 +306,9 @@ valInfo* ENode::consGt(bool isLvalue) {
 valInfo* ENode::consGeq(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
-    us_geq(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (NarrowChildren(a, b)) mpz_set_ui(ret->consVal, a >= b);
+    else us_geq(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
   }
   return ret;
@@ -304,7 +317,9 @@ valInfo* ENode::consGeq(bool isLvalue) {
 valInfo* ENode::consEq(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
-    us_eq(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (NarrowChildren(a, b)) mpz_set_ui(ret->consVal, a == b);
+    else us_eq(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
   } else if ((ChildCons(0, status) == VAL_CONSTANT && mpzOutOfBound(ChildCons(0, consVal), Child(1, width)))
       ||(ChildCons(1, status) == VAL_CONSTANT && mpzOutOfBound(ChildCons(1, consVal), Child(0, width)))) {
@@ -316,7 +331,9 @@ valInfo* ENode::consEq(bool isLvalue) {
 valInfo* ENode::consNeq(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
-    us_neq(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (NarrowChildren(a, b)) mpz_set_ui(ret->consVal, a != b);
+    else us_neq(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
   }
   return ret;
@@ -326,7 +343,9 @@ valInfo* ENode::consDshl(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
     if (sign) TODO();
-    u_dshl(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (NarrowChildren(a, b) && b < 64) mpz_set_ui(ret->consVal, a << b);
+    else u_dshl(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
   }
   return ret;
@@ -335,7 +354,9 @@ valInfo* ENode::consDshl(bool isLvalue) {
 valInfo* ENode::consDshr(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
-    (sign ? s_dshr : u_dshr)(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (NarrowChildren(a, b)) mpz_set_ui(ret->consVal, b < 64 ? a >> b : 0);
+    else (sign ? s_dshr : u_dshr)(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
   }
   return ret;
@@ -345,7 +366,9 @@ valInfo* ENode::consAnd(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
     if (sign) TODO();
-    u_and(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (NarrowChildren(a, b)) mpz_set_ui(ret->consVal, a & b);
+    else u_and(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
   } else if ((ChildCons(0, status) == VAL_CONSTANT && mpz_sgn(ChildCons(0, consVal)) == 0) ||
             (ChildCons(1, status) == VAL_CONSTANT && mpz_sgn(ChildCons(1, consVal)) == 0)) {
@@ -356,18 +379,17 @@ valInfo* ENode::consAnd(bool isLvalue) {
 
 valInfo* ENode::consOr(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
-  mpz_t mask;
-  mpz_init(mask);
-  mpz_set_ui(mask, 1);
-  mpz_mul_2exp(mask, mask, width);
-  mpz_sub_ui(mask, mask, 1);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
     if (sign) TODO();
-    u_ior(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (NarrowChildren(a, b)) mpz_set_ui(ret->consVal, a | b);
+    else u_ior(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
-  } else if ((ChildCons(0, status) == VAL_CONSTANT && mpz_cmp(ChildCons(0, consVal), mask) == 0) ||
-            (ChildCons(1, status) == VAL_CONSTANT && mpz_cmp(ChildCons(1, consVal), mask) == 0)) {
-    mpz_set(ret->consVal, mask);
+  } else if ((ChildCons(0, status) == VAL_CONSTANT && allOnes(ChildCons(0, consVal), width)) ||
+            (ChildCons(1, status) == VAL_CONSTANT && allOnes(ChildCons(1, consVal), width))) {
+    mpz_set_ui(ret->consVal, 1);
+    mpz_mul_2exp(ret->consVal, ret->consVal, width);
+    mpz_sub_ui(ret->consVal, ret->consVal, 1);
     ret->updateConsVal();
   }
   return ret;
@@ -377,7 +399,9 @@ valInfo* ENode::consXor(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
     if (sign) TODO();
-    u_xor(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (NarrowChildren(a, b)) mpz_set_ui(ret->consVal, a ^ b);
+    else u_xor(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
   }
   return ret;
@@ -387,7 +411,9 @@ valInfo* ENode::consCat(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if ((ChildCons(0, status) == VAL_CONSTANT) && (ChildCons(1, status) == VAL_CONSTANT)) {
     if (sign) TODO();
-    u_cat(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
+    uint64_t a, b;
+    if (ChildCons(1, width) < 64 && NarrowChildren(a, b)) mpz_set_ui(ret->consVal, (a << ChildCons(1, width)) | b);
+    else u_cat(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), ChildCons(1, consVal), ChildCons(1, width));
     ret->updateConsVal();
   }
   return ret;
@@ -456,7 +482,12 @@ valInfo* ENode::consNot(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if (ChildCons(0, status) == VAL_CONSTANT) {
     if (sign) TODO();
-    u_not(ret->consVal, ChildCons(0, consVal), ChildCons(0, width));
+    uint64_t a;
+    if (ChildCons(0, width) <= 64 && narrowCons(consEMap[getChild(0)], a)) {
+      mpz_set_ui(ret->consVal, ChildCons(0, width) == 64 ? ~a : a ^ ((1UL << ChildCons(0, width)) - 1));
+    } else {
+      u_not(ret->consVal, ChildCons(0, consVal), ChildCons(0, width));
+    }
     ret->updateConsVal();
   }
   return ret;
@@ -512,7 +543,9 @@ valInfo* ENode::consShl(bool isLvalue) {
 
   if (ChildCons(0, status) == VAL_CONSTANT) {
     if (sign) TODO();
-    u_shl(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), n);
+    uint64_t a;
+    if (width <= 64 && n < 64 && narrowCons(consEMap[getChild(0)], a)) mpz_set_ui(ret->consVal, a << n);
+    else u_shl(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), n);
     ret->updateConsVal();
   }
   return ret;
@@ -521,7 +554,9 @@ valInfo* ENode::consShl(bool isLvalue) {
 valInfo* ENode::consShr(bool isLvalue) {
   valInfo* ret = new valInfo(width, sign);
   if (ChildCons(0, status) == VAL_CONSTANT) {
-    (sign ? s_shr : u_shr)(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), values[0]);  // n(values[0]) == width
+    uint64_t a;
+    if (!sign && narrowCons(consEMap[getChild(0)], a)) mpz_set_ui(ret->consVal, values[0] < 64 ? a >> values[0] : 0);
+    else (sign ? s_shr : u_shr)(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), values[0]);  // n(values[0]) == width
     ret->updateConsVal();
   }
   return ret;
@@ -564,7 +599,12 @@ valInfo* ENode::consBits(bool isLvalue) {
   int lo = values[1];
 
   if (ChildCons(0, status) == VAL_CONSTANT) {
-    u_bits(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), hi, lo);
+    uint64_t a;
+    if (hi - lo + 1 < 64 && narrowCons(consEMap[getChild(0)], a)) {
+      mpz_set_ui(ret->consVal, (lo >= 64 ? 0 : a >> lo) & ((1UL << (hi - lo + 1)) - 1));
+    } else {
+      u_bits(ret->consVal, ChildCons(0, consVal), ChildCons(0, width), hi, lo);
+    }
     ret->updateConsVal();
   } else if (lo >= Child(0, width) || lo >= ChildCons(0, width)) {
     ret->setConstantByStr("0");
@@ -766,6 +806,86 @@ void clearConsEMap(ExpTree* tree) {
   }
 }
 
+/* drop the values of the enodes in tree, and collect them to be released */
+static void releaseConsEMap(ExpTree* tree, std::set<valInfo*>& infos) {
+  std::stack<ENode*> s;
+  s.push(tree->getRoot());
+  while(!s.empty()) {
+    ENode* top = s.top();
+    s.pop();
+    if (!top) continue;
+    if (consEMap.find(top) != consEMap.end()) {
+      infos.insert(consEMap[top]);
+      consEMap.erase(top);
+    }
+    for (ENode* child : top->child) s.push(child);
+  }
+}
+
+/*
+  evaluate the members of super for every value of inputs (concatenated, inputs[0] in the lowest bits)
+  and record the values of outputs in table, used to replace pure superNodes by lookup tables
+  return false if any member is not a constant under some input value
+*/
+bool tabulateSuper(SuperNode* super, std::vector<Node*>& inputs, std::vector<Node*>& outputs, std::vector<std::vector<uint64_t>>& table) {
+  std::map<Node*, valInfo*> savedCons;
+  for (Node* node : inputs) savedCons[node] = consMap.find(node) == consMap.end() ? nullptr : consMap[node];
+  for (Node* member : super->member) savedCons[member] = consMap.find(member) == consMap.end() ? nullptr : consMap[member];
+  for (Node* member : super->member) clearConsEMap(member->assignTree[0]); // values of the constant analysis
+  int bits = 0;
+  for (Node* node : inputs) bits += node->width;
+  table.assign(outputs.size(), std::vector<uint64_t>((size_t)1 << bits));
+  bool isConstant = true;
+  mpz_t val;
+  mpz_init(val);
+  for (uint64_t idx = 0; isConstant && idx < ((uint64_t)1 << bits); idx ++) {
+    std::set<valInfo*> infos;
+    /* members not evaluated yet must not expose the values of the last iteration */
+    for (Node* member : super->member) {
+      if (savedCons[member]) consMap[member] = savedCons[member];
+      else consMap.erase(member);
+    }
+    int shift = 0;
+    for (Node* node : inputs) {
+      valInfo* info = new valInfo(node->width, node->sign);
+      mpz_set_ui(info->consVal, BITS(idx, shift + node->width - 1, shift));
+      info->updateConsVal();
+      consMap[node] = info;
+      infos.insert(info);
+      shift += node->width;
+    }
+    for (Node* member : super->member) {
+      valInfo* info = member->assignTree[0]->getRoot()->computeConstant(member, false);
+      if (info->status != VAL_CONSTANT) {
+        isConstant = false;
+        break;
+      }
+      info = info->dup();
+      info->width = member->width;
+      info->sign = member->sign;
+      info->updateConsVal();
+      consMap[member] = info;
+      infos.insert(info);
+    }
+    for (size_t i = 0; isConstant && i < outputs.size(); i ++) {
+      mpz_fdiv_r_2exp(val, consMap[outputs[i]]->consVal, outputs[i]->width);
+      table[i][idx] = mpz_get_ui(val);
+    }
+    for (Node* member : super->member) releaseConsEMap(member->assignTree[0], infos);
+    for (valInfo* info : infos) {
+      mpz_clear(info->consVal);
+      mpz_clear(info->assignmentCons);
+      delete info;
+    }
+  }
+  mpz_clear(val);
+  for (auto iter : savedCons) {
+    if (iter.second) consMap[iter.first] = iter.second;
+    else consMap.erase(iter.first);
+  }
+  return isConstant;
+}
+
 static void recomputeAllNodes() {
   while (!recomputeQueue.empty()) {
     Node* node = recomputeQueue.top();
@@ -5,16 +5,18 @@
 #include "common.h"
 #include "util.h"
 
+#include <climits>
 #include <cstddef>
 #include <cstdio>
 #include <map>
 #include <string>
 #include <utility>
 
-#define ACTIVE_WIDTH 8
+#define ACTIVE_WIDTH (globalConfig.ActiveWidth)
+#define SUMMARY_WIDTH 64 // activeFlags words covered by one activeSummary word
 #define RESET_PER_FUNC 400
-
-#define ENABLE_ACTIVATOR false
+#define COLD_MIN_INSTS 4 // smaller superNodes are not worth a call
+#define ACTIVITY_VERSION 1 // layout of the activity profile written by the emitted model
 
 #ifdef DIFFTEST_PER_SIG
 FILE* sigFile = nullptr;
@@ -31,20 +33,163 @@ FILE* sigFile = nullptr;
 
 static int superId = 0;
 static int activeFlagNum = 0;
+static int activeSummaryNum = 0;
 static std::set<Node*> definedNode;
 static std::map<int, SuperNode*> cppId2Super;
 static std::set<int> alwaysActive;
+static std::set<int> coldSuper; // evaluated by outlined cold functions
+static std::map<Node*, int> watchIdx; // watched outputs and their bits in watchChanged
+static std::set<SuperNode*> lazySuper; // evaluated by the getters of their outputs
+static int lazyWordBase = INT_MAX; // first activeFlags word of lazy superNodes, never visited by step()
 
 static std::map<Node*, std::pair<int, int>> super2ResetId;  // uint & async reset
 
 extern int maxConcatNum;
 bool nameExist(std::string str);
+bool lazyOutputMember(Node* member);
 static int resetFuncNum = 0;
 
 static bool isAlwaysActive(int cppId) {
   return alwaysActive.find(cppId) != alwaysActive.end();
 }
 
+/* with --skip-idle, inputs still set the flags of alwaysActive superNodes, so that quiescent() sees them */
+static bool tracksAlwaysActive(int cppId) {
+  return globalConfig.SkipIdle && isAlwaysActive(cppId);
+}
+
+static std::string extModName(SuperNode* super) {
+  Node* ext = super->member[0];
+  return ext->extraInfo.length() ? ext->extraInfo : ext->name;
+}
+
+/* see --pure-extmodules */
+static bool isPureExtMod(SuperNode* super) {
+  const std::vector<std::string>& pure = globalConfig.PureExtModules;
+  return std::find(pure.begin(), pure.end(), extModName(super)) != pure.end();
+}
+
+static bool isCold(int cppId) {
+  return coldSuper.find(cppId) != coldSuper.end();
+}
+
+static bool isWatched(Node* node) {
+  return watchIdx.find(node) != watchIdx.end();
+}
+
+/* activeFlags are shared by all threads in threaded mode, so updates must be atomic */
+static bool isThreaded() {
+  return globalConfig.ThreadNum > 1;
+}
+
+static std::string activeOrStr(std::string flag, int bits, std::string val) {
+  if (isThreaded()) return format("__atomic_fetch_or((uint%d_t*)&%s, %s, __ATOMIC_RELAXED);", bits, flag.c_str(), val.c_str());
+  if (bits == ACTIVE_WIDTH) return format("%s |= %s;", flag.c_str(), val.c_str());
+  return format("*(uint%d_t*)&%s |= %s;", bits, flag.c_str(), val.c_str());
+}
+
+/*
+  bit k of activeSummary[r] is set if activeFlags[r * SUMMARY_WIDTH + k] may be nonzero,
+  so that the step function only visits the flag words with pending activations
+*/
+static bool useActiveSummary() {
+  return !isThreaded();
+}
+
+static uint64_t flagWordMask() {
+  return ACTIVE_WIDTH == 64 ? (uint64_t)-1 : ((uint64_t)1 << ACTIVE_WIDTH) - 1;
+}
+
+/*
+  summary bits of the flag words touched by mask, which starts at activeFlags[idx]
+  merged masks start at a multiple of 64 / ACTIVE_WIDTH and never cross summary words
+*/
+static uint64_t summaryMask(int idx, uint64_t mask) {
+  uint64_t ret = 0;
+  for (int i = 0; i * ACTIVE_WIDTH < 64 && idx + i < lazyWordBase; i ++) {
+    if ((mask >> (i * ACTIVE_WIDTH)) & flagWordMask()) ret |= (uint64_t)1 << ((idx + i) % SUMMARY_WIDTH);
+  }
+  return ret;
+}
+
+/*
+  lane mode: every state variable keeps globalConfig.Lanes independent copies, and the code
+  touching them is emitted in lane blocks, which bind the entries of the current lane to
+  references with the original names, so the generated expressions are kept unchanged
+*/
+static std::set<std::string> laneStateNames;
+static FILE* laneOuterFp = NULL;
+static char* laneBuf = NULL;
+static size_t laneBufSize = 0;
+
+static bool isLaneMode() {
+  return globalConfig.Lanes > 1;
+}
+
+static std::string laneArg() {
+  return isLaneMode() ? "lane" : "";
+}
+
+/*
+  state snapshot: the layout hash covers the type and shape of every variable between
+  _var_start and _var_end, and the activation flags, so a snapshot is rejected by a model
+  with a different state layout
+*/
+#define STATE_VERSION 1
+static uint64_t stateLayoutHash = 0xcbf29ce484222325; // FNV-1a
+
+static void hashStateLayout(std::string str) {
+  for (char c : str) stateLayoutHash = (stateLayoutHash ^ (uint8_t)c) * 0x100000001b3;
+  stateLayoutHash = (stateLayoutHash ^ ';') * 0x100000001b3;
+}
+
+/* variables between _var_start and _var_end, collected by genNodeDef and placed by genStateLayout */
+enum StateRegion { STATE_HOT, STATE_COLD, STATE_MEMORY, STATE_REGION_NUM };
+static const char* stateRegionName[STATE_REGION_NUM] = {"hot", "cold", "memory"};
+struct StateVar {
+  std::string decl;
+  std::string comment;
+  Node* node;
+  size_t bytes;
+  size_t align;
+  StateRegion region;
+  size_t group; // variables of the same superNode share a group
+  size_t offset;
+};
+static std::vector<StateVar> stateVars;
+struct SparseMemory {
+  Node* node;
+  std::string dims;
+  size_t bytes;
+};
+static std::vector<SparseMemory> sparseMemory; // page-backed memories
+
+static StateRegion stateRegion(Node* node) {
+  if (node->type == NODE_MEMORY) return STATE_MEMORY;
+  if (node->super->cppId >= 0 && isCold(node->super->cppId)) return STATE_COLD;
+  if (node->type != NODE_OTHERS) return STATE_HOT;
+  if (node->next.empty()) return STATE_COLD; // only kept for debugging and difftest
+  for (Node* next : node->next) {
+    if (next->type != NODE_SPECIAL) return STATE_HOT;
+  }
+  return STATE_COLD; // only read by printf and assert
+}
+
+static void addStateVar(Node* node, std::string decl, std::string comment, size_t num) {
+  size_t elemBytes = widthBits(node->width) / 8;
+  size_t align = MIN(elemBytes, (size_t)8); // _BitInt(N > 64) is aligned to 8 bytes
+  size_t group = stateVars.empty() ? 0 : stateVars.back().group;
+  if (!stateVars.empty() && stateVars.back().node->super != node->super) group ++;
+  stateVars.push_back({decl, comment, node, elemBytes * num, align, stateRegion(node), group, 0});
+}
+
+static int activeMaskBits(uint64_t mask) {
+  if (mask <= MAX_U8) return 8;
+  if (mask <= MAX_U16) return 16;
+  if (mask <= MAX_U32) return 32;
+  return 64;
+}
+
 std::pair<int, int> cppId2flagIdx(int cppId) {
   int id = cppId / ACTIVE_WIDTH;
   int bit = cppId % ACTIVE_WIDTH;
@@ -72,7 +217,7 @@ ActiveType activeSet2bitMap(std::set<int>& activeId, std::map<uint64_t, ActiveTy
   std::string comment = "";
   int uniqueIdx = 0;
   for (int id : activeId) {
-    if (isAlwaysActive(id)) continue;
+    if (isAlwaysActive(id) && !tracksAlwaysActive(id)) continue;
     int bitMapId;
     uint64_t bitMapMask;
     std::tie(bitMapId, bitMapMask) = setIdxMask(id);
@@ -111,24 +256,20 @@ ActiveType activeSet2bitMap(std::set<int>& activeId, std::map<uint64_t, ActiveTy
 }
 
 std::string updateActiveStr(int idx, uint64_t mask) {
-  if (mask <= MAX_U8) return format("activeFlags[%d] |= 0x%lx;", idx, mask);
-  if (mask <= MAX_U16) return format("*(uint16_t*)&activeFlags[%d] |= 0x%lx;", idx, mask);
-  if (mask <= MAX_U32) return format("*(uint32_t*)&activeFlags[%d] |= 0x%lx;", idx, mask);
-  return format("*(uint64_t*)&activeFlags[%d] |= 0x%lx;", idx, mask);
+  std::string ret = activeOrStr(format("activeFlags[%d]", idx), MAX(activeMaskBits(mask), ACTIVE_WIDTH), format("0x%lx", mask));
+  if (useActiveSummary() && summaryMask(idx, mask) != 0) ret += format(" activeSummary[%d] |= 0x%lx;", idx / SUMMARY_WIDTH, summaryMask(idx, mask));
+  return ret;
 }
 
 std::string updateActiveStr(int idx, uint64_t mask, std::string& cond, int uniqueId) {
   auto activeFlags = std::string("activeFlags[") + std::to_string(idx) + std::string("]");
+  int bits = MAX(activeMaskBits(mask), ACTIVE_WIDTH);
 
-  if (mask <= MAX_U8) {
-    if (uniqueId >= 0) return format("%s |= %s%s;", activeFlags.c_str(), cond.c_str(), shiftBits(uniqueId, ShiftDir::Left).c_str());
-    else return format("%s |= -(uint8_t)%s & 0x%lx;", activeFlags.c_str(), cond.c_str(), mask, activeFlags.c_str());
-  }
-  if (mask <= MAX_U16)
-    return format("*(uint16_t*)&%s |= -(uint16_t)%s & 0x%lx;", activeFlags.c_str(), cond.c_str(), mask, activeFlags.c_str());
-  if (mask <= MAX_U32)
-    return format("*(uint32_t*)&%s |= -(uint32_t)%s & 0x%lx;", activeFlags.c_str(), cond.c_str(), mask, activeFlags.c_str());
-  return format("*(uint64_t*)&%s |= -(uint64_t)%s & 0x%lx;", activeFlags.c_str(), cond.c_str(), mask, activeFlags.c_str());
+  if (isThreaded()) return format("if (%s) %s", cond.c_str(), activeOrStr(activeFlags, bits, format("0x%lx", mask)).c_str());
+  std::string summary;
+  if (summaryMask(idx, mask) != 0) summary = format(" activeSummary[%d] |= -(uint64_t)%s & 0x%lx;", idx / SUMMARY_WIDTH, cond.c_str(), summaryMask(idx, mask));
+  if (bits == 8 && uniqueId >= 0) return format("%s |= %s%s;", activeFlags.c_str(), cond.c_str(), shiftBits(uniqueId, ShiftDir::Left).c_str()) + summary;
+  return activeOrStr(activeFlags, bits, format("-(uint%d_t)%s & 0x%lx", bits, cond.c_str(), mask)) + summary;
 }
 
 static void inline includeLib(FILE* fp, std::string lib, bool isStd) {
@@ -163,6 +304,8 @@ FILE* graph::genHeaderStart() {
   includeLib(header, "cstring", true);
   includeLib(header, "map", true);
   includeLib(header, "cstdarg", true);
+  fprintf(header, "#ifdef GSIM_STATE_ZSTD\n#include <zstd.h>\n#endif\n"); // saveState/loadState of files
+  if (isThreaded()) includeLib(header, "thread", true);
   newLine(header);
 
   fprintf(header, "\n// User configuration\n");
@@ -178,6 +321,23 @@ FILE* graph::genHeaderStart() {
                      "}"
                    "} while (0)\n");
   fprintf(header, "#define gdiv(a, b) ((b) == 0 ? 0 : (a) / (b))\n");
+  /* assertions and stop of the design, returned by run() if requested in stopMask */
+  fprintf(header, "#define gStopAssert(cond, ...) do {"
+                     "if (!(cond)) {"
+                       "if (stopMask & GSIM_STOP_ASSERT) {"
+                         "fprintf(stderr, \"\\33[1;31m\");"
+                         "fprintf(stderr, __VA_ARGS__);"
+                         "fprintf(stderr, \"\\33[0m\\n\");"
+                         "__atomic_fetch_or(&stopCause, GSIM_STOP_ASSERT, __ATOMIC_RELAXED);"
+                       "} else gAssert(cond, __VA_ARGS__);"
+                     "}"
+                   "} while (0)\n");
+  fprintf(header, "#define gExit(code) do {"
+                     "if (stopMask & GSIM_STOP_EXIT) {"
+                       "exitCode = code;"
+                       "__atomic_fetch_or(&stopCause, GSIM_STOP_EXIT, __ATOMIC_RELAXED);"
+                     "} else exit(code);"
+                   "} while (0)\n");
 
   fprintf(header, "#ifndef __BITINT_MAXWIDTH__\n");
   fprintf(header, "#error  BITINT support is required\n");
@@ -193,6 +353,157 @@ FILE* graph::genHeaderStart() {
   fprintf(header, "#define likely(x) __builtin_expect(!!(x), 1)\n");
   fprintf(header, "#define unlikely(x) __builtin_expect(!!(x), 0)\n");
   fprintf(header, "void gprintf(const char *fmt, ...);\n\n");
+  if (isLaneMode()) fprintf(header, "#define GSIM_LANES %d\n\n", globalConfig.Lanes);
+
+  if (globalConfig.WideKernels) {
+    fprintf(header, "#ifndef GSIM_WIDE_KERNELS\n");
+    fprintf(header, "#define GSIM_WIDE_KERNELS\n");
+    fprintf(header, "static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, \"wide kernels read values wider than 64 bits as little-endian words\");\n");
+    fprintf(header, "typedef uint64_t __attribute__((may_alias)) gsim_word_t;\n");
+    fprintf(header, "// the w-bit field (w <= 64) at bit lo of a value wider than 64 bits, lo and w are constants\n");
+    fprintf(header, "static inline uint64_t gsim_bits64(const void* src, int lo, int w) {\n"
+                    "  const gsim_word_t* word = (const gsim_word_t*)src + lo / 64;\n"
+                    "  uint64_t val = word[0] >> (lo %% 64);\n"
+                    "  if (lo %% 64 != 0 && lo %% 64 + w > 64) val |= word[1] << (64 - lo %% 64);\n"
+                    "  return w == 64 ? val : val & (((uint64_t)1 << w) - 1);\n"
+                    "}\n");
+    fprintf(header, "// the w-bit field (64 < w <= 128)\n");
+    fprintf(header, "static inline unsigned __int128 gsim_bits128(const void* src, int lo, int w) {\n"
+                    "  return gsim_bits64(src, lo, 64) | ((unsigned __int128)gsim_bits64(src, lo + 64, w - 64) << 64);\n"
+                    "}\n");
+    fprintf(header, "// word-wise operators on unsigned values wider than 64 bits, T is the unsigned _BitInt type of the result\n");
+    for (std::string op : {"and:&", "or:|", "xor:^"}) {
+      size_t colon = op.find(':');
+      fprintf(header, "template <typename T> static inline T gsim_%s(T a, T b) {\n"
+                      "  T ret;\n"
+                      "  for (size_t i = 0; i < sizeof(T) / 8; i ++) ((gsim_word_t*)&ret)[i] = ((gsim_word_t*)&a)[i] %s ((gsim_word_t*)&b)[i];\n"
+                      "  return ret;\n"
+                      "}\n", op.substr(0, colon).c_str(), op.substr(colon + 1).c_str());
+    }
+    fprintf(header, "template <typename T> static inline T gsim_not(T a, int w) {\n"
+                    "  T ret;\n"
+                    "  for (size_t i = 0; i < sizeof(T) / 8; i ++) {\n"
+                    "    uint64_t mask = (int)(64 * i + 64) <= w ? ~(uint64_t)0 : ((int)(64 * i) >= w ? 0 : ((uint64_t)1 << (w %% 64)) - 1);\n"
+                    "    ((gsim_word_t*)&ret)[i] = ~((gsim_word_t*)&a)[i] & mask;\n"
+                    "  }\n"
+                    "  return ret;\n"
+                    "}\n");
+    fprintf(header, "// shifts by a constant n, moving whole words and the bits between neighbouring words\n");
+    fprintf(header, "template <typename T> static inline T gsim_shl(T a, int n) {\n"
+                    "  T ret;\n"
+                    "  const gsim_word_t* src = (const gsim_word_t*)&a;\n"
+                    "  for (int i = 0; i < (int)(sizeof(T) / 8); i ++) {\n"
+                    "    int idx = i - n / 64;\n"
+                    "    uint64_t val = idx >= 0 ? src[idx] << (n %% 64) : 0;\n"
+                    "    if (n %% 64 != 0 && idx >= 1) val |= src[idx - 1] >> (64 - n %% 64);\n"
+                    "    ((gsim_word_t*)&ret)[i] = val;\n"
+                    "  }\n"
+                    "  return ret;\n"
+                    "}\n");
+    fprintf(header, "template <typename T> static inline T gsim_shr(T a, int n) {\n"
+                    "  T ret;\n"
+                    "  const gsim_word_t* src = (const gsim_word_t*)&a;\n"
+                    "  for (int i = 0; i < (int)(sizeof(T) / 8); i ++) {\n"
+                    "    int idx = i + n / 64;\n"
+                    "    uint64_t val = idx < (int)(sizeof(T) / 8) ? src[idx] >> (n %% 64) : 0;\n"
+                    "    if (n %% 64 != 0 && idx + 1 < (int)(sizeof(T) / 8)) val |= src[idx + 1] << (64 - n %% 64);\n"
+                    "    ((gsim_word_t*)&ret)[i] = val;\n"
+                    "  }\n"
+                    "  return ret;\n"
+                    "}\n");
+    fprintf(header, "// {hi, lo} where lo has loWidth bits\n");
+    fprintf(header, "template <typename T> static inline T gsim_cat(T hi, T lo, int loWidth) {\n"
+                    "  return gsim_or<T>(gsim_shl<T>(hi, loWidth), lo);\n"
+                    "}\n");
+    fprintf(header, "#endif\n\n");
+  }
+
+  if (globalConfig.SparseMemoryKB >= 0) {
+    fprintf(header, "#ifndef GSIM_SPARSE_MEMORY\n");
+    fprintf(header, "#define GSIM_SPARSE_MEMORY\n");
+    fprintf(header, "#include <sys/mman.h>\n");
+    fprintf(header, "#define GSIM_SPARSE_PAGE 4096\n");
+    fprintf(header, "// storage of a large memory in anonymous pages, which are zero-filled on the first access\n");
+    fprintf(header, "template <typename T> struct GSIMSparse {\n"
+                    "  T* ptr;\n"
+                    "  GSIMSparse() {\n"
+                    "    ptr = (T*)mmap(NULL, sizeof(T), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);\n"
+                    "    gAssert(ptr != MAP_FAILED, \"failed to map %%ld bytes\", sizeof(T));\n"
+                    "  }\n"
+                    "  ~GSIMSparse() { munmap(ptr, sizeof(T)); }\n"
+                    "  GSIMSparse(const GSIMSparse&) = delete;\n"
+                    "  GSIMSparse& operator=(const GSIMSparse&) = delete;\n"
+                    "  void clear() { madvise(ptr, sizeof(T), MADV_DONTNEED); } // drop the pages, read as zero again\n"
+                    "  void load(const uint8_t* src) { // copy the nonzero pages of src, the others are left unmapped\n"
+                    "    clear();\n"
+                    "    for (size_t offset = 0; offset < sizeof(T); offset += GSIM_SPARSE_PAGE) {\n"
+                    "      size_t len = sizeof(T) - offset < GSIM_SPARSE_PAGE ? sizeof(T) - offset : GSIM_SPARSE_PAGE;\n"
+                    "      const uint8_t* page = src + offset;\n"
+                    "      if (page[0] == 0 && memcmp(page, page + 1, len - 1) == 0) continue;\n"
+                    "      memcpy((uint8_t*)ptr + offset, page, len);\n"
+                    "    }\n"
+                    "  }\n"
+                    "};\n");
+    fprintf(header, "#endif\n\n");
+  }
+
+  /* shared by all models in a binary */
+  fprintf(header, "#ifndef GSIM_STOP_CYCLES\n");
+  fprintf(header, "#define GSIM_STOP_CYCLES 0x1 // the cycle budget of run() is used up\n");
+  fprintf(header, "#define GSIM_STOP_ASSERT 0x2\n");
+  fprintf(header, "#define GSIM_STOP_EXIT 0x4\n");
+  fprintf(header, "#define GSIM_STOP_OUTPUT 0x8 // a watched output changes to a nonzero value\n");
+  fprintf(header, "struct StopMask {\n"
+                  "  uint32_t events; // GSIM_STOP_ASSERT and GSIM_STOP_EXIT end run() instead of the process\n"
+                  "  uint64_t nonzero; // watched outputs (1 << WATCH_<name>) ending run() when they change to nonzero\n"
+                  "};\n");
+  fprintf(header, "#endif\n\n");
+
+  fprintf(header, "#ifndef GSIM_STATE_VERSION\n");
+  fprintf(header, "#define GSIM_STATE_VERSION %d\n", STATE_VERSION);
+  fprintf(header, "#define GSIM_STATE_MAGIC \"GSIMSTAT\"\n");
+  fprintf(header, "#define GSIM_STATE_ZSTD_LEVEL 3\n");
+  fprintf(header, "struct GSIMStateHeader {\n"
+                  "  char magic[8];\n"
+                  "  uint32_t version;\n"
+                  "  uint32_t reserved;\n"
+                  "  uint64_t layoutHash;\n"
+                  "  uint64_t size; // bytes following the header\n"
+                  "};\n");
+  fprintf(header, "#endif\n\n");
+
+  if (globalConfig.InstrumentActivity) {
+    fprintf(header, "#ifndef GSIM_ACTIVITY_VERSION\n");
+    fprintf(header, "#define GSIM_ACTIVITY_VERSION %d\n", ACTIVITY_VERSION);
+    fprintf(header, "#define GSIM_ACTIVITY_MAGIC \"GSIMACTV\"\n");
+    fprintf(header, "#define GSIM_ACTIVITY_INTERVAL 16 // sample activeFlags every 16 cycles by default\n");
+    fprintf(header, "// followed by superNum records of {uint64_t count; uint32_t nameLen; char names[nameLen];}\n");
+    fprintf(header, "struct GSIMActivityHeader {\n"
+                    "  char magic[8];\n"
+                    "  uint32_t version;\n"
+                    "  uint32_t superNum;\n"
+                    "  uint64_t cycles; // sampled cycles\n"
+                    "  uint64_t interval;\n"
+                    "};\n");
+    fprintf(header, "#endif\n\n");
+  }
+
+  if (isThreaded()) {
+    fprintf(header, "#define THREAD_PAD 8 // one cache line per thread\n");
+    fprintf(header, "#define THREAD_EXIT UINT64_MAX\n");
+    fprintf(header, "#if defined(__x86_64__) || defined(__i386__)\n");
+    fprintf(header, "#define THREAD_PAUSE() __builtin_ia32_pause()\n");
+    fprintf(header, "#else\n");
+    fprintf(header, "#define THREAD_PAUSE() do { } while (0)\n");
+    fprintf(header, "#endif\n");
+    fprintf(header, "// give up the core after spinning for a while, in case of oversubscription\n");
+    fprintf(header, "#define THREAD_SPIN(cond) do { "
+                      "for (int spin = 0; (cond); spin ++) { if (spin < 4096) THREAD_PAUSE(); else std::this_thread::yield(); } "
+                    "} while (0)\n");
+    fprintf(header, "#define THREAD_WAIT(tid, pos) "
+                      "THREAD_SPIN(__atomic_load_n(&threadProgress[(tid) * THREAD_PAD], __ATOMIC_ACQUIRE) < (pos))\n");
+    fprintf(header, "#define THREAD_PUBLISH(tid, pos) __atomic_store_n(&threadProgress[(tid) * THREAD_PAD], (pos), __ATOMIC_RELEASE)\n\n");
+  }
 
   for (int num = 2; num <= maxConcatNum; num ++) {
     std::string param;
@@ -211,10 +522,30 @@ FILE* graph::genHeaderStart() {
 }
 
 void graph::genInterfaceInput(Node* input) {
+  std::string inputName = input->name;
+  if (input->status == CONSTANT_NODE) { // tied by the port manifest
+    std::string mask = input->width >= 64 ? "" : format(" & 0x%lx", ((uint64_t)1 << input->width) - 1);
+    std::string check = format("  gAssert((val%s) == (%s%s), \"%s is tied to %%s by the port manifest\", \"%s\");\n",
+                               mask.c_str(), input->computeInfo->valStr.c_str(), mask.c_str(), input->name.c_str(), input->computeInfo->valStr.c_str());
+    if (isLaneMode()) {
+      emitFuncDecl(0, "void S%s::set_%s(int lane, %s val) {\n%s}\n", name.c_str(), input->name.c_str(), widthUType(input->width).c_str(), check.c_str());
+    }
+    emitFuncDecl(0, "void S%s::set_%s(%s val) {\n%s}\n", name.c_str(), input->name.c_str(), widthUType(input->width).c_str(), check.c_str());
+    return;
+  }
   /* set by string */
-  emitFuncDecl(0, "void S%s::set_%s(%s val) {\n", name.c_str(), input->name.c_str(), widthUType(input->width).c_str());
-  emitBodyLock(1, "if (%s != val) { \n", input->name.c_str());
-  emitBodyLock(2, "%s = val;\n", input->name.c_str());
+  if (isLaneMode()) {
+    /* set all lanes, or a single lane */
+    emitFuncDecl(0, "void S%s::set_%s(%s val) {\n"
+                    "  for (int lane = 0; lane < GSIM_LANES; lane ++) set_%s(lane, val);\n"
+                    "}\n", name.c_str(), input->name.c_str(), widthUType(input->width).c_str(), input->name.c_str());
+    emitFuncDecl(0, "void S%s::set_%s(int lane, %s val) {\n", name.c_str(), input->name.c_str(), widthUType(input->width).c_str());
+    inputName += "[lane]";
+  } else {
+    emitFuncDecl(0, "void S%s::set_%s(%s val) {\n", name.c_str(), input->name.c_str(), widthUType(input->width).c_str());
+  }
+  emitBodyLock(1, "if (%s != val) { \n", inputName.c_str());
+  emitBodyLock(2, "%s = val;\n", inputName.c_str());
   /* update nodes in the same superNode */
   std::set<int> allNext;
   for (Node* next : input->next) {
@@ -230,11 +561,24 @@ void graph::genInterfaceInput(Node* input) {
 }
 
 void graph::genInterfaceOutput(Node* output) {
-  emitFuncDecl(0, "%s S%s::get_%s() {\n"
+  std::string outputName = output->name + (isLaneMode() ? "[lane]" : "");
+  if (output->status == VALID_NODE && lazySuper.find(output->super) != lazySuper.end()) {
+    int id;
+    uint64_t mask;
+    std::tie(id, mask) = setIdxMask(output->super->cppId);
+    emitFuncDecl(0, "%s S%s::get_%s(%s) {\n"
+                 "  if (activeFlags[%d] & 0x%lx) lazySuper%d();\n"
+                 "  return %s;\n"
+                 "}\n",
+                 widthUType(output->width).c_str(), name.c_str(), output->name.c_str(), isLaneMode() ? "int lane" : "",
+                 id, mask, output->super->cppId, outputName.c_str());
+    return;
+  }
+  emitFuncDecl(0, "%s S%s::get_%s(%s) {\n"
                "  return %s;\n"
                "}\n",
-               widthUType(output->width).c_str(), name.c_str(),
-               output->name.c_str(), output->status == CONSTANT_NODE ? output->computeInfo->valStr.c_str() : output->name.c_str());
+               widthUType(output->width).c_str(), name.c_str(), output->name.c_str(), isLaneMode() ? "int lane" : "",
+               output->status == CONSTANT_NODE ? output->computeInfo->valStr.c_str() : outputName.c_str());
 }
 
 void graph::genHeaderEnd(FILE* fp) {
@@ -336,10 +680,27 @@ void graph::genNodeDef(FILE* fp, Node* node) {
 #endif
   if (definedNode.find(node) != definedNode.end()) return;
   definedNode.insert(node);
-  fprintf(fp, "%s %s", widthUType(node->width).c_str(), node->name.c_str());
-  if (node->type == NODE_MEMORY) fprintf(fp, "[%d]", upperPower2(node->depth));
-  for (int dim : node->dimension) fprintf(fp, "[%d]", upperPower2(dim));
-  fprintf(fp, "; // width = %d, lineno = %d\n", node->width, node->lineno);
+  std::string dims;
+  if (isLaneMode()) {
+    dims += "[GSIM_LANES]";
+    laneStateNames.insert(node->name);
+  }
+  size_t num = isLaneMode() ? globalConfig.Lanes : 1;
+  if (node->type == NODE_MEMORY) {
+    dims += format("[%d]", upperPower2(node->depth));
+    num *= upperPower2(node->depth);
+  }
+  for (int dim : node->dimension) {
+    dims += format("[%d]", upperPower2(dim));
+    num *= upperPower2(dim);
+  }
+  std::string decl = widthUType(node->width) + " " + node->name + dims;
+  if (node->type == NODE_MEMORY && globalConfig.SparseMemoryKB >= 0 &&
+      num * (widthBits(node->width) / 8) >= (size_t)globalConfig.SparseMemoryKB * 1024) {
+    sparseMemory.push_back({node, dims, num * (widthBits(node->width) / 8)});
+    return;
+  }
+  addStateVar(node, decl, format(" // width = %d, lineno = %d", node->width, node->lineno), num);
   int w = node->width;
   bool needInitMask = (node->type != NODE_MEMORY && node->type != NODE_WRITER) &&
     (((w < 64) && (w != 8 && w != 16 && w != 32 && w != 64)) || ((w > 64) && (w % 32 != 0)));
@@ -362,13 +723,322 @@ void graph::genNodeDef(FILE* fp, Node* node) {
   /* save reset registers */
   if (node->isReset() && node->type == NODE_REG_SRC) {
     Assert(!node->isArray() && node->width <= BASIC_WIDTH, "%s is treated as reset (isArray: %d width: %d)", node->name.c_str(), node->isArray(), node->width);
-    fprintf(fp, "%s %s;\n", widthUType(node->width).c_str(), RESET_NAME(node).c_str());
+    std::string resetDecl = widthUType(node->width) + " " + RESET_NAME(node) + (isLaneMode() ? "[GSIM_LANES]" : "");
+    addStateVar(node, resetDecl, "", isLaneMode() ? globalConfig.Lanes : 1);
+    if (isLaneMode()) laneStateNames.insert(RESET_NAME(node));
     if (needInitMask) {
       emitBodyLock(1, "%s = %s & %s;\n", RESET_NAME(node).c_str(), RESET_NAME(node).c_str(), bitMask(w).c_str());
     }
   }
 }
 
+/* assign offsets from _var_start, return the average number of cache lines written and read by a superNode */
+static double stateCacheLines(std::vector<StateVar*>& order, std::vector<SuperNode*>& supers, bool report) {
+  size_t offset = sizeof(uint32_t); // _var_start
+  size_t bytes[STATE_REGION_NUM] = {0}, padding[STATE_REGION_NUM] = {0}, num[STATE_REGION_NUM] = {0};
+  std::map<Node*, std::vector<StateVar*>> nodeVars;
+  for (StateVar* var : order) {
+    size_t start = ROUNDUP(offset, var->align);
+    padding[var->region] += start - offset;
+    bytes[var->region] += var->bytes + start - offset;
+    num[var->region] ++;
+    var->offset = start;
+    offset = start + var->bytes;
+    if (var->region != STATE_MEMORY) nodeVars[var->node].push_back(var);
+  }
+  size_t lines = 0;
+  for (SuperNode* super : supers) {
+    std::set<size_t> superLines;
+    auto addLines = [&](Node* node) {
+      if (nodeVars.find(node) == nodeVars.end()) return;
+      for (StateVar* var : nodeVars[node]) {
+        for (size_t line = var->offset / 64; line * 64 < var->offset + var->bytes; line ++) superLines.insert(line);
+      }
+    };
+    for (Node* member : super->member) {
+      addLines(member);
+      for (Node* prev : member->prev) addLines(prev);
+    }
+    lines += superLines.size();
+  }
+  if (report) {
+    for (int i = 0; i < STATE_REGION_NUM; i ++) {
+      printf("[stateLayout] %s: %ld variables, %ld bytes (%ld bytes of padding)\n", stateRegionName[i], num[i], bytes[i], padding[i]);
+    }
+  }
+  return supers.empty() ? 0 : (double)lines / supers.size();
+}
+
+/*
+  state layout: with --state-layout, the variables are placed in the hot, cold and memory regions,
+  the hot ones grouped by superNode in cppId order (co-activated superNodes are neighbors) and
+  sorted by alignment inside a group to avoid padding
+*/
+void graph::genStateLayout(FILE* header) {
+  std::vector<StateVar*> order;
+  for (StateVar& var : stateVars) order.push_back(&var);
+  std::vector<SuperNode*> supers;
+  for (int i = 0; i < superId; i ++) supers.push_back(cppId2Super[i]);
+  double declLines = stateCacheLines(order, supers, !globalConfig.StateLayout);
+  if (globalConfig.StateLayout) {
+    std::stable_sort(order.begin(), order.end(), [](StateVar* a, StateVar* b) {
+      if (a->region != b->region) return a->region < b->region;
+      if (a->region == STATE_HOT && a->group != b->group) return a->group < b->group;
+      return a->align > b->align;
+    });
+    double lines = stateCacheLines(order, supers, true);
+    printf("[stateLayout] %.2lf cache lines per superNode evaluation (%.2lf in declaration order)\n", lines, declLines);
+  } else {
+    printf("[stateLayout] %.2lf cache lines per superNode evaluation\n", declLines);
+  }
+  int region = -1;
+  for (StateVar* var : order) {
+    if (globalConfig.StateLayout && var->region != region) {
+      region = var->region;
+      fprintf(header, "// state region: %s\n", stateRegionName[region]);
+    }
+    hashStateLayout(var->decl);
+    fprintf(header, "%s;%s\n", var->decl.c_str(), var->comment.c_str());
+  }
+}
+
+/*
+  memories of at least --sparse-memory-KB are placed out of [_var_start, _var_end) in pages mapped on demand,
+  the array reference keeps the accesses (and &mem, sizeof(mem) in the harness) unchanged
+*/
+void graph::genSparseMemory(FILE* header) {
+  size_t bytes = 0;
+  for (SparseMemory& sparse : sparseMemory) {
+    Node* mem = sparse.node;
+    std::string type = widthUType(mem->width);
+    hashStateLayout(format("%s %s%s", type.c_str(), mem->name.c_str(), sparse.dims.c_str()));
+    fprintf(header, "GSIMSparse<%s%s> %s$pages;\n", type.c_str(), sparse.dims.c_str(), mem->name.c_str());
+    fprintf(header, "%s (&%s)%s = *%s$pages.ptr; // width = %d, lineno = %d\n", type.c_str(), mem->name.c_str(), sparse.dims.c_str(),
+            mem->name.c_str(), mem->width, mem->lineno);
+    emitBodyLock(1, "%s$pages.clear();\n", mem->name.c_str());
+    bytes += sparse.bytes;
+  }
+  if (globalConfig.SparseMemoryKB >= 0) printf("[cppEmitter] %ld memories (%ld KB) are backed by pages on demand\n", sparseMemory.size(), bytes / 1024);
+}
+
+/*
+  idle cycles: a free-running counter is a register updated by reg := reg + inc in every cycle and only
+  read by its update and by comparisons with constants (thresholds). A cycle is idle if no superNode is
+  active except the ones of the counters, then skipIdle() advances the counters in closed form until
+  the first cycle changing a threshold comparison
+*/
+struct IdleCounter {
+  Node* reg;
+  uint64_t inc;
+  std::vector<std::pair<Node*, uint64_t>> thresholds; // comparisons of reg (left operand) and constants
+  std::vector<OPType> ops;
+};
+
+static bool consLeaf(ENode* enode, uint64_t& val) {
+  if (enode && enode->opType == OP_INT && enode->getChildNum() == 0) {
+    auto value = firStrBase(enode->strVal);
+    mpz_t cons;
+    mpz_init(cons);
+    bool valid = mpz_set_str(cons, value.second.c_str(), value.first) == 0 && mpz_sgn(cons) >= 0 && mpz_sizeinbase(cons, 2) <= 64;
+    if (valid) val = mpz_get_ui(cons);
+    mpz_clear(cons);
+    return valid;
+  }
+  if (!enode || !enode->computeInfo || enode->computeInfo->status != VAL_CONSTANT || !enode->computeInfo->consFitsU64()) return false;
+  val = mpz_get_ui(enode->computeInfo->consVal);
+  return true;
+}
+
+static bool regLeaf(ENode* enode, Node* reg) {
+  return enode && enode->nodePtr == reg && enode->getChildNum() == 0;
+}
+
+/* the operation with the register on the left */
+static OPType swapCompare(OPType op) {
+  switch (op) {
+    case OP_LT: return OP_GT;
+    case OP_LEQ: return OP_GEQ;
+    case OP_GT: return OP_LT;
+    case OP_GEQ: return OP_LEQ;
+    default: return op;
+  }
+}
+
+static bool detectCounter(Node* reg, IdleCounter& counter) {
+  Node* dst = reg->getDst();
+  if (reg->status != VALID_NODE || reg->isArray() || reg->width >= 64 || reg->isReset() || !dst || !dst->regSplit) return false;
+  if (dst->status != VALID_NODE || dst->assignTree.size() != 1) return false;
+  ENode* root = dst->assignTree[0]->getRoot();
+  if ((root->opType == OP_TAIL || root->opType == OP_BITS) && root->width == reg->width && root->getChildNum() == 1) root = root->getChild(0);
+  if (root->opType != OP_ADD || root->getChildNum() != 2) return false;
+  counter.reg = reg;
+  if (!((regLeaf(root->getChild(0), reg) && consLeaf(root->getChild(1), counter.inc)) ||
+        (regLeaf(root->getChild(1), reg) && consLeaf(root->getChild(0), counter.inc)))) return false;
+  counter.inc &= ((uint64_t)1 << reg->width) - 1;
+  for (Node* next : dst->next) {
+    if (next != reg) return false;
+  }
+  for (Node* next : reg->next) {
+    if (next == dst) continue;
+    /* thresholds are only followed for counters incremented by 1 */
+    if (counter.inc != 1 || next->status != VALID_NODE || next->type != NODE_OTHERS || next->assignTree.size() != 1) return false;
+    ENode* cmp = next->assignTree[0]->getRoot();
+    if (cmp->opType < OP_LT || cmp->opType > OP_NEQ || cmp->getChildNum() != 2) return false;
+    uint64_t threshold;
+    if (regLeaf(cmp->getChild(0), reg) && consLeaf(cmp->getChild(1), threshold)) counter.ops.push_back(cmp->opType);
+    else if (regLeaf(cmp->getChild(1), reg) && consLeaf(cmp->getChild(0), threshold)) counter.ops.push_back(swapCompare(cmp->opType));
+    else return false;
+    counter.thresholds.push_back(std::make_pair(next, threshold));
+  }
+  return true;
+}
+
+/* members are counters or functions of their thresholds, which keep their values in idle cycles */
+static bool counterSuper(SuperNode* super, std::set<Node*>& counterNodes) {
+  std::set<Node*> constNodes(counterNodes);
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (Node* member : super->member) {
+      if (member->status != VALID_NODE || constNodes.find(member) != constNodes.end()) continue;
+      if ((member->type != NODE_OTHERS && member->type != NODE_OUT) || member->isArray()) return false;
+      bool derived = true;
+      for (Node* prev : member->prev) {
+        if (constNodes.find(prev) == constNodes.end()) derived = false;
+      }
+      if (!derived) continue;
+      constNodes.insert(member);
+      changed = true;
+    }
+  }
+  for (Node* member : super->member) {
+    if (member->status == VALID_NODE && constNodes.find(member) == constNodes.end()) return false;
+  }
+  return true;
+}
+
+/* cycles until reg op threshold changes, if reg counts up by 1 from val */
+static std::string compareDistance(OPType op, std::string val, uint64_t threshold, int width) {
+  uint64_t max = ((uint64_t)1 << width) - 1;
+  switch (op) {
+    case OP_EQ: case OP_NEQ:
+      return format("(%s == 0x%lx ? 1 : ((0x%lx - %s) & 0x%lx))", val.c_str(), threshold, threshold, val.c_str(), max);
+    case OP_LT: case OP_GEQ: // changes when reaching threshold, or at the wrap to 0
+      if (threshold == 0) return "UINT64_MAX";
+      return format("(%s < 0x%lx ? 0x%lx - %s : 0x%lx - %s)", val.c_str(), threshold, threshold, val.c_str(), max + 1, val.c_str());
+    case OP_LEQ: case OP_GT: // changes when passing threshold, or at the wrap to 0
+      if (threshold == max) return "UINT64_MAX";
+      return format("(%s <= 0x%lx ? 0x%lx - %s : 0x%lx - %s)", val.c_str(), threshold, threshold + 1, val.c_str(), max + 1, val.c_str());
+    default: Panic();
+  }
+  return "";
+}
+
+void graph::genSkipIdle(FILE* header) {
+  std::vector<IdleCounter> counters;
+  for (Node* reg : regsrc) {
+    IdleCounter counter;
+    if (detectCounter(reg, counter)) counters.push_back(counter);
+  }
+  /* a pending counter superNode is ignored by quiescent(), so it must not evaluate anything else */
+  for (bool changed = true; changed; ) {
+    changed = false;
+    std::set<Node*> counterNodes;
+    for (IdleCounter& counter : counters) {
+      counterNodes.insert(counter.reg);
+      counterNodes.insert(counter.reg->getDst());
+      for (auto iter : counter.thresholds) counterNodes.insert(iter.first);
+    }
+    for (size_t i = 0; i < counters.size(); i ++) {
+      if (counterSuper(counters[i].reg->super, counterNodes) && counterSuper(counters[i].reg->getDst()->super, counterNodes)) continue;
+      counters.erase(counters.begin() + i);
+      changed = true;
+      break;
+    }
+  }
+  std::set<int> idleIds;
+  for (IdleCounter& counter : counters) {
+    for (SuperNode* super : {counter.reg->super, counter.reg->getDst()->super}) {
+      if (super->cppId >= 0) idleIds.insert(super->cppId);
+    }
+  }
+  int laneIndent = isLaneMode() ? 2 : 1;
+  std::map<int, uint64_t> idleMask; // flag words with counter superNodes
+  for (int id : idleIds) idleMask[id / ACTIVE_WIDTH] |= (uint64_t)1 << (id % ACTIVE_WIDTH);
+  /* flags of no superNode are set by activateAll() and never cleared */
+  if (superId % ACTIVE_WIDTH != 0) idleMask[superId / ACTIVE_WIDTH] |= (~(uint64_t)0 >> (64 - ACTIVE_WIDTH)) & ~(((uint64_t)1 << (superId % ACTIVE_WIDTH)) - 1);
+
+  fprintf(header, "bool quiescent();\n");
+  fprintf(header, "uint64_t skipIdle(uint64_t maxCycles);\n");
+
+  emitFuncDecl(0, "bool S%s::quiescent() {\n", name.c_str());
+  /* an extmodule may keep state or have side effects (DPI, memories, printing), so it is called every cycle */
+  std::string impureExt;
+  for (SuperNode* super : sortedSuper) {
+    if (super->superType == SUPER_EXTMOD && !isPureExtMod(super)) impureExt = extModName(super);
+  }
+  if (!impureExt.empty()) {
+    printf("[cppEmitter] extmodule %s is not declared pure, quiescent() is always false\n", impureExt.c_str());
+    emitBodyLock(1, "return false; // extmodule %s is not declared pure\n", impureExt.c_str());
+  } else {
+    beginLaneBlock();
+    for (SuperNode* super : allReset) {
+      if (super->resetNode->status == CONSTANT_NODE) continue;
+      emitBodyLock(laneIndent, "if (%s) return false;\n", super->resetNode->name.c_str());
+    }
+    endLaneBlock(1, true);
+    int indent = 1;
+    int usedWords = (superId + ACTIVE_WIDTH - 1) / ACTIVE_WIDTH;
+    if (useActiveSummary()) { // only the words with a summary bit may be nonzero
+      emitBodyLock(indent ++, "for (int i = 0; i < %d; i ++) {\n", activeSummaryNum);
+      emitBodyLock(indent ++, "for (uint64_t pending = activeSummary[i]; pending != 0; pending &= pending - 1) {\n");
+      emitBodyLock(indent, "int word = i * %d + __builtin_ctzll(pending);\n", SUMMARY_WIDTH);
+      emitBodyLock(indent, "if (word >= %d) break; // padding words are never cleared\n", usedWords);
+    } else {
+      emitBodyLock(indent ++, "for (int word = 0; word < %d; word ++) {\n", usedWords);
+    }
+    emitBodyLock(indent, "uint%d_t counterMask = 0;\n", ACTIVE_WIDTH);
+    if (!idleMask.empty()) {
+      emitBodyLock(indent, "switch (word) {\n");
+      for (auto iter : idleMask) emitBodyLock(indent + 1, "case %d: counterMask = 0x%lx; break;\n", iter.first, iter.second);
+      emitBodyLock(indent, "}\n");
+    }
+    /* pure extmodules are idle if their inputs have not set their flags since they were evaluated */
+    emitBodyLock(indent, "if (activeFlags[word] & ~counterMask) return false;\n");
+    while (indent > 1) emitBodyLock(-- indent, "}\n");
+    emitBodyLock(1, "return true;\n");
+  }
+  emitBodyLock(0, "}\n");
+
+  emitFuncDecl(0, "uint64_t S%s::skipIdle(uint64_t maxCycles) {\n", name.c_str());
+  emitBodyLock(1, "if (!quiescent()) return 0;\n");
+  emitBodyLock(1, "uint64_t n = maxCycles;\n");
+  beginLaneBlock();
+  for (IdleCounter& counter : counters) {
+    for (size_t i = 0; i < counter.thresholds.size(); i ++) {
+      std::string distance = compareDistance(counter.ops[i], counter.reg->name, counter.thresholds[i].second, counter.reg->width);
+      emitBodyLock(laneIndent, "n = std::min<uint64_t>(n, %s - 1); // %s\n", distance.c_str(), counter.thresholds[i].first->name.c_str());
+    }
+  }
+  endLaneBlock(1, true);
+  emitBodyLock(1, "if (n == 0) return 0;\n");
+  beginLaneBlock();
+  for (IdleCounter& counter : counters) {
+    uint64_t mask = ((uint64_t)1 << counter.reg->width) - 1;
+    std::string regName = counter.reg->name;
+    emitBodyLock(laneIndent, "%s = (%s + 0x%lx * n) & 0x%lx;\n", regName.c_str(), regName.c_str(), counter.inc, mask);
+    emitBodyLock(laneIndent, "%s = (%s + 0x%lx) & 0x%lx;\n", counter.reg->getDst()->name.c_str(), regName.c_str(), counter.inc, mask);
+  }
+  endLaneBlock(1, true);
+  emitBodyLock(1, "cycles += n;\n");
+  emitBodyLock(1, "return n;\n");
+  emitBodyLock(0, "}\n");
+
+  printf("[cppEmitter] %ld free-running counters are skipped in idle cycles\n", counters.size());
+  for (IdleCounter& counter : counters) {
+    printf("[cppEmitter] counter %s += %ld, %ld thresholds\n", counter.reg->name.c_str(), counter.inc, counter.thresholds.size());
+  }
+}
+
 void graph::activateNext(Node* node, std::set<int>& nextNodeId, std::string oldName, bool inStep, std::string flagName, int indent) {
   std::string nodeName = node->name;
   auto condName = std::string("cond_") + nodeName;
@@ -396,25 +1066,18 @@ void graph::activateNext(Node* node, std::set<int>& nextNodeId, std::string oldN
   if (node->isAsyncReset()) {
     Assert(!opt, "invalid opt");
     emitBodyLock(indent, "activateAll();\n");
-    emitBodyLock(indent, "%s = -1;\n", flagName.c_str());
+    if (!isThreaded()) emitBodyLock(indent, "%s = -1;\n", flagName.c_str());
   } else {
     if (ACTIVE_MASK(curMask) != 0) {
-      if (opt) emitBodyLock(indent, "%s |= -(uint%d_t)%s & 0x%lx; // %s\n", flagName.c_str(), ACTIVE_WIDTH, condName.c_str() ,ACTIVE_MASK(curMask), ACTIVE_COMMENT(curMask).c_str());
-      else emitBodyLock(indent, "%s |= 0x%lx; // %s\n", flagName.c_str(), ACTIVE_MASK(curMask), ACTIVE_COMMENT(curMask).c_str());
+      std::string maskStr = format("0x%lx", ACTIVE_MASK(curMask));
+      if (opt && isThreaded()) emitBodyLock(indent, "if (%s) %s // %s\n", condName.c_str(), activeOrStr(flagName, ACTIVE_WIDTH, maskStr).c_str(), ACTIVE_COMMENT(curMask).c_str());
+      else if (opt) emitBodyLock(indent, "%s |= -(uint%d_t)%s & 0x%lx; // %s\n", flagName.c_str(), ACTIVE_WIDTH, condName.c_str() ,ACTIVE_MASK(curMask), ACTIVE_COMMENT(curMask).c_str());
+      else emitBodyLock(indent, "%s // %s\n", activeOrStr(flagName, ACTIVE_WIDTH, maskStr).c_str(), ACTIVE_COMMENT(curMask).c_str());
     }
     for (auto iter : bitMapInfo) {
       auto str = opt ? updateActiveStr(iter.first, ACTIVE_MASK(iter.second), condName, ACTIVE_UNIQUE(iter.second)) : updateActiveStr(iter.first, ACTIVE_MASK(iter.second));
       emitBodyLock(indent, "%s // %s\n", str.c_str(), ACTIVE_COMMENT(iter.second).c_str());
     }
-  #ifdef PERF
-    #if ENABLE_ACTIVATOR
-    for (int id : nextNodeId) {
-      emitBodyLock(indent, "if (activator[%d].find(%d) == activator[%d].end()) activator[%d][%d] = 0;\nactivator[%d][%d] ++;\n",
-                  id, node->super->cppId, id, id, node->super->cppId, id, node->super->cppId);
-    }
-    #endif
-    if (inStep && node->type != NODE_EXT_OUT) emitBodyLock(indent, "isActivateValid = true;\n");
-  #endif
   }
   if (!opt) emitBodyLock(-- indent, "}\n");
 }
@@ -422,35 +1085,27 @@ void graph::activateNext(Node* node, std::set<int>& nextNodeId, std::string oldN
 void graph::activateUncondNext(Node* node, std::set<int>& activateId, bool inStep, std::string flagName, int indent) {
   std::map<uint64_t, ActiveType> bitMapInfo;
   auto curMask = activeSet2bitMap(activateId, bitMapInfo, node->super->cppId);
-  if (ACTIVE_MASK(curMask) != 0) emitBodyLock(indent, "%s |= 0x%lx; // %s\n", flagName.c_str(), ACTIVE_MASK(curMask), ACTIVE_COMMENT(curMask).c_str());
+  if (ACTIVE_MASK(curMask) != 0) emitBodyLock(indent, "%s // %s\n", activeOrStr(flagName, ACTIVE_WIDTH, format("0x%lx", ACTIVE_MASK(curMask))).c_str(), ACTIVE_COMMENT(curMask).c_str());
   for (auto iter : bitMapInfo) {
     emitBodyLock(indent, "%s // %s\n", updateActiveStr(iter.first, ACTIVE_MASK(iter.second)).c_str(), ACTIVE_COMMENT(iter.second).c_str());
   }
-#ifdef PERF
-  #if ENABLE_ACTIVATOR
-  for (int id : activateId) {
-    emitBodyLock(indent, "if (activator[%d].find(%d) == activator[%d].end()) activator[%d][%d] = 0;\n activator[%d][%d] ++;\n",
-                id, node->super->cppId, id, id, node->super->cppId, id, node->super->cppId);
-  }
-  #endif
-  if (inStep) emitBodyLock(indent, "isActivateValid = true;\n");
-#endif
 }
 
 int graph::genNodeStepStart(SuperNode* node, uint64_t mask, int idx, std::string flagName, int indent) {
   nodeNum ++;
-  if (!isAlwaysActive(node->cppId)) {
-    emitBodyLock(indent ++, "if(unlikely(%s & 0x%lx)) { // id=%d\n", flagName.c_str(), mask, idx);
-  }
   int id;
   uint64_t newMask;
   std::tie(id, newMask) = clearIdxMask(node->cppId);
-#ifdef PERF
-  emitBodyLock(indent, "activeTimes[%d] ++;\n", node->cppId);
-  if (node->superType != SUPER_EXTMOD) {
-    emitBodyLock(indent, "bool isActivateValid = false;\n");
+  if (!isAlwaysActive(node->cppId) && isThreaded()) {
+    emitBodyLock(indent ++, "if(unlikely(__atomic_load_n(&%s, __ATOMIC_RELAXED) & 0x%lx)) { // id=%d\n", flagName.c_str(), mask, idx);
+    emitBodyLock(indent, "__atomic_fetch_and(&%s, 0x%lx, __ATOMIC_RELAXED);\n", flagName.c_str(), newMask);
+  } else if (!isAlwaysActive(node->cppId)) {
+    emitBodyLock(indent ++, "if(unlikely(%s & 0x%lx)) { // id=%d\n", flagName.c_str(), mask, idx);
+  } else if (tracksAlwaysActive(node->cppId) && isThreaded()) {
+    emitBodyLock(indent, "__atomic_fetch_and(&%s, 0x%lx, __ATOMIC_RELAXED); // id=%d\n", flagName.c_str(), newMask, idx);
   }
-#endif
+  /* threads test the flags one superNode at a time, so there is no flag word to sample (see genActivate) */
+  if (globalConfig.InstrumentActivity && isThreaded()) emitBodyLock(indent, "if (unlikely(activitySampling)) activityCounts[%d] ++;\n", node->cppId);
   return indent;
 }
 
@@ -496,12 +1151,6 @@ void graph::nodeDisplay(Node* member, int indent) {
 }
 
 int graph::genNodeStepEnd(SuperNode* node, int indent) {
-#ifdef PERF
-  if (node->superType != SUPER_EXTMOD) {
-    emitBodyLock(indent, "validActive[%d] += isActivateValid;\n", node->cppId);
-  }
-#endif
-
   if(!isAlwaysActive(node->cppId)) {
     emitBodyLock(-- indent, "}\n");
   }
@@ -527,10 +1176,16 @@ int graph::translateInst(InstInfo inst, int indent, std::string flagName) {
       emitBodyLock(indent, "%s\n", inst.inst.c_str());
       break;
     case SUPER_INFO_ASSIGN_BEG:
-      if (inst.node->isLocal() || inst.node->isArray() || inst.node->type == NODE_WRITER) break;
+      /* the old value is only compared to activate successors that are not always active, or to report watched outputs */
+      if (!isWatched(inst.node) && (inst.node->isLocal() || !inst.node->needActivate() || inst.node->isArray() || inst.node->type == NODE_WRITER)) break;
       emitBodyLock(indent, "%s %s = %s;\n", widthUType(inst.node->width).c_str(), oldName(inst.node).c_str(), inst.node->name.c_str());
       break;
     case SUPER_INFO_ASSIGN_END:
+      if (isWatched(inst.node)) {
+        if (isThreaded()) emitBodyLock(indent, "if (%s != %s) __atomic_fetch_or(&watchChanged, (uint64_t)1 << %d, __ATOMIC_RELAXED);\n",
+                                      inst.node->name.c_str(), oldName(inst.node).c_str(), watchIdx[inst.node]);
+        else emitBodyLock(indent, "watchChanged |= (uint64_t)(%s != %s) << %d;\n", inst.node->name.c_str(), oldName(inst.node).c_str(), watchIdx[inst.node]);
+      }
       if (inst.node->isLocal() || !inst.node->needActivate()) break;
       if (inst.node->isArray() || inst.node->type == NODE_WRITER) activateUncondNext(inst.node, inst.node->nextActiveId, false, flagName, indent);
       else activateNext(inst.node, inst.node->nextActiveId, oldName(inst.node), false, flagName, indent);
@@ -542,6 +1197,11 @@ int graph::translateInst(InstInfo inst, int indent, std::string flagName) {
 }
 
 void graph::genSuperEval(SuperNode* super, std::string flagName, int indent) { // current indent = 2
+  int outerIndent = indent;
+  if (isLaneMode()) {
+    beginLaneBlock();
+    indent ++;
+  }
   if (super->superType == SUPER_EXTMOD) { // TODO: normalize
     /* save old EXT_OUT*/
     for (size_t i = 1; i < super->member.size(); i ++) {
@@ -559,7 +1219,7 @@ void graph::genSuperEval(SuperNode* super, std::string flagName, int indent) { /
     }
   } else {
     if (super->superType == SUPER_ASYNC_RESET) {
-      emitBodyLock(indent, "subReset%d();\n", super2ResetId[super->resetNode].second);
+      emitBodyLock(indent, "subReset%d(%s);\n", super2ResetId[super->resetNode].second, laneArg().c_str());
     }
     /* local nodes definition */
     for (Node* n : super->member) {
@@ -570,58 +1230,159 @@ void graph::genSuperEval(SuperNode* super, std::string flagName, int indent) { /
     for (InstInfo inst : super->insts) {
       indent = translateInst(inst, indent, flagName);
     }
-    if (super->superType == SUPER_ASYNC_RESET) emitBodyLock(indent, "subReset%d();\n", super2ResetId[super->resetNode].second);
+    if (super->superType == SUPER_ASYNC_RESET) emitBodyLock(indent, "subReset%d(%s);\n", super2ResetId[super->resetNode].second, laneArg().c_str());
     emitBodyLock(indent, "#ifdef ENABLE_LOG\n");
     emitBodyLock(indent ++, "if (cycles >= LOG_START && cycles <= LOG_END) {\n");
     for (Node* n : super->member) nodeDisplay(n, indent);
     emitBodyLock(-- indent, "}\n");
     emitBodyLock(indent, "#endif\n");
   }
+  endLaneBlock(outerIndent, true);
 }
 
 
+/*
+  flag words are visited by scanning the set bits of activeSummary with ctz, in increasing order,
+  so that superNodes activated by earlier ones are still evaluated in the same cycle.
+  A scan ends at the first bit without a case label, and the next function resumes from there.
+*/
 int graph::genActivate() {
     emitFuncDecl(0, "void S%s::subStep0() {\n", name.c_str());
     int indent = 1;
     int nextSubStepIdx = 1;
     std::string nextFuncDef = format("void S%s::subStep%d()", name.c_str(), nextSubStepIdx);
-    bool prevActiveWhole = false;
-    for (int idx = 0; idx < superId; idx ++) {
-      int id;
-      uint64_t mask;
-      std::tie(id, mask) = setIdxMask(idx);
-      int offset = idx % ACTIVE_WIDTH;
-      if (offset == 0) {
-        if (prevActiveWhole) {
-          emitBodyLock(--indent, "}\n");
-        }
-        prevActiveWhole = true;
-        for (int j = 0; j < ACTIVE_WIDTH && idx + j < superId; j ++) {
-          if (isAlwaysActive(idx + j)) prevActiveWhole = false;
+    bool inScan = false;
+    auto endScan = [&]() {
+      emitBodyLock(indent, "default: visitedGroup = (uint64_t)-1; // continued in the next scan\n");
+      emitBodyLock(-- indent, "}\n");
+      emitBodyLock(-- indent, "}\n");
+      inScan = false;
+    };
+    for (int id = 0; id < (superId + ACTIVE_WIDTH - 1) / ACTIVE_WIDTH; id ++) {
+      int summaryIdx = id / SUMMARY_WIDTH;
+      int summaryBit = id % SUMMARY_WIDTH;
+      bool fileFull = srcFileBytes > (globalConfig.cppMaxSizeKB * 1024); // the same as __emitSrc
+      if (inScan && (summaryBit == 0 || fileFull)) endScan();
+      if (!inScan) {
+        bool newFile = __emitSrc(indent ++, true, false, nextFuncDef.c_str(),
+                                 "for (uint64_t visitedGroup = 0x%lx, pendingGroup; (pendingGroup = activeSummary[%d] & ~visitedGroup) != 0; ) {\n",
+                                 ((uint64_t)1 << summaryBit) - 1, summaryIdx);
+        if (newFile) {
+          nextFuncDef = format("void S%s::subStep%d()", name.c_str(), ++ nextSubStepIdx);
         }
-        if (prevActiveWhole) {
-          bool newFile = __emitSrc(indent ++, true, false, nextFuncDef.c_str(), "if(unlikely(activeFlags[%d] != 0)) {\n", id);
-          if (newFile) {
-            nextFuncDef = format("void S%s::subStep%d()", name.c_str(), ++ nextSubStepIdx);
-          }
-          emitBodyLock(indent, "uint%d_t oldFlag = activeFlags[%d];\n", ACTIVE_WIDTH, id);
-          emitBodyLock(indent, "activeFlags[%d] = 0;\n", id);
+        emitBodyLock(indent, "int groupIdx = __builtin_ctzll(pendingGroup);\n");
+        emitBodyLock(indent, "visitedGroup = ((uint64_t)2 << groupIdx) - 1;\n");
+        emitBodyLock(indent ++, "switch (groupIdx) {\n");
+        inScan = true;
+      }
+      /* groups with alwaysActive superNodes keep their summary bit */
+      bool activeWhole = true;
+      for (int idx = id * ACTIVE_WIDTH; idx < (id + 1) * ACTIVE_WIDTH && idx < superId; idx ++) {
+        if (isAlwaysActive(idx)) activeWhole = false;
+      }
+      emitBodyLock(indent ++, "case %d: { // activeFlags[%d]\n", summaryBit, id);
+      if (activeWhole) {
+        emitBodyLock(indent, "activeSummary[%d] &= 0x%lx;\n", summaryIdx, ~((uint64_t)1 << summaryBit));
+        emitBodyLock(indent, "uint%d_t oldFlag = activeFlags[%d];\n", ACTIVE_WIDTH, id);
+        emitBodyLock(indent, "activeFlags[%d] = 0;\n", id);
+        if (globalConfig.InstrumentActivity) emitBodyLock(indent, "if (unlikely(activitySampling)) sampleActivity(%d, oldFlag);\n", id);
+      } else if (globalConfig.InstrumentActivity) { // alwaysActive superNodes run without their flags
+        uint64_t alwaysMask = 0;
+        for (int idx = id * ACTIVE_WIDTH; idx < (id + 1) * ACTIVE_WIDTH && idx < superId; idx ++) {
+          if (isAlwaysActive(idx)) alwaysMask |= (uint64_t)1 << (idx % ACTIVE_WIDTH);
         }
+        emitBodyLock(indent, "if (unlikely(activitySampling)) sampleActivity(%d, activeFlags[%d] | 0x%lx);\n", id, id, alwaysMask);
+      }
+      for (int idx = id * ACTIVE_WIDTH; idx < (id + 1) * ACTIVE_WIDTH && idx < superId; idx ++) {
+        uint64_t mask, clearMask;
+        std::tie(std::ignore, mask) = setIdxMask(idx);
+        std::tie(std::ignore, clearMask) = clearIdxMask(idx);
+        SuperNode* super = cppId2Super[idx];
+        std::string flagName = activeWhole ? "oldFlag" : format("activeFlags[%d]", id);
+        indent = genNodeStepStart(super, mask, idx, flagName, indent);
+        if (!activeWhole && (!isAlwaysActive(idx) || tracksAlwaysActive(idx))) emitBodyLock(indent, "%s &= 0x%lx;\n", flagName.c_str(), clearMask);
+        if (isCold(idx)) emitBodyLock(indent, "coldSuper%d(%s);\n", idx, flagName.c_str());
+        else genSuperEval(super, flagName, indent);
+        indent = genNodeStepEnd(super, indent);
       }
-      SuperNode* super = cppId2Super[idx];
-      std::string flagName = prevActiveWhole ? "oldFlag" : format("activeFlags[%d]", id);
-      indent = genNodeStepStart(super, mask, idx, flagName, indent);
-      genSuperEval(super, flagName, indent);
-      indent = genNodeStepEnd(super, indent);
+      emitBodyLock(indent, "break;\n");
+      emitBodyLock(-- indent, "}\n");
     }
+    if (inScan) endScan();
     emitBodyLock(--indent, "}\n");
-    if (prevActiveWhole) emitBodyLock(--indent, "}\n");
 
     return nextSubStepIdx - 1; // return the maxinum subStepIdx currently used
 }
 
+void graph::genThreadActivate(std::vector<int>& subStepNum) {
+  for (int t = 0; t < globalConfig.ThreadNum; t ++) {
+    emitFuncDecl(0, "void S%s::threadStep%d_0() {\n", name.c_str(), t);
+    int nextSubStepIdx = 1;
+    std::string nextFuncDef = format("void S%s::threadStep%d_%d()", name.c_str(), t, nextSubStepIdx);
+    for (SuperNode* super : threadTasks[t]) {
+      bool newFile = __emitSrc(1, true, false, nextFuncDef.c_str(), "// task %d: id=%d\n", super->threadPos, super->cppId);
+      if (newFile) {
+        nextFuncDef = format("void S%s::threadStep%d_%d()", name.c_str(), t, ++ nextSubStepIdx);
+      }
+      for (auto wait : super->threadWait) {
+        emitBodyLock(1, "THREAD_WAIT(%d, %d);\n", wait.first, wait.second);
+      }
+      int id;
+      uint64_t mask;
+      std::tie(id, mask) = setIdxMask(super->cppId);
+      std::string flagName = format("activeFlags[%d]", id);
+      int indent = genNodeStepStart(super, mask, super->cppId, flagName, 1);
+      if (isCold(super->cppId)) emitBodyLock(indent, "coldSuper%d(%s);\n", super->cppId, flagName.c_str());
+      else genSuperEval(super, flagName, indent);
+      genNodeStepEnd(super, indent);
+      if (super->threadPublish) emitBodyLock(1, "THREAD_PUBLISH(%d, %d);\n", t, super->threadPos);
+    }
+    emitBodyLock(0, "}\n");
+    subStepNum.push_back(nextSubStepIdx);
+  }
+}
+
+void graph::genThreadStep(std::vector<int>& subStepNum) {
+  int threadNum = globalConfig.ThreadNum;
+  for (int t = 0; t < threadNum; t ++) {
+    emitFuncDecl(0, "void S%s::threadStep%d() {\n", name.c_str(), t);
+    for (int i = 0; i < subStepNum[t]; i ++) emitBodyLock(1, "threadStep%d_%d();\n", t, i);
+    emitBodyLock(0, "}\n");
+  }
+
+  /* worker threads wait for a new epoch and then evaluate their own superNodes */
+  emitFuncDecl(0, "void S%s::threadWorker(int tid) {\n", name.c_str());
+  emitBodyLock(1, "uint64_t seen = 0;\n");
+  emitBodyLock(1, "while (true) {\n");
+  emitBodyLock(2, "uint64_t epoch;\n");
+  emitBodyLock(2, "THREAD_SPIN((epoch = __atomic_load_n(&threadEpoch, __ATOMIC_ACQUIRE)) == seen);\n");
+  emitBodyLock(2, "if (epoch == THREAD_EXIT) return;\n");
+  emitBodyLock(2, "seen = epoch;\n");
+  emitBodyLock(2, "switch (tid) {\n");
+  for (int t = 1; t < threadNum; t ++) emitBodyLock(3, "case %d: threadStep%d(); break;\n", t, t);
+  emitBodyLock(2, "}\n");
+  emitBodyLock(2, "__atomic_store_n(&threadDone[tid * THREAD_PAD], epoch, __ATOMIC_RELEASE);\n");
+  emitBodyLock(1, "}\n");
+  emitBodyLock(0, "}\n");
+
+  emitFuncDecl(0, "void S%s::startThreads() {\n", name.c_str());
+  emitBodyLock(1, "threadEpoch = 0;\n");
+  emitBodyLock(1, "for (int i = 1; i < %d; i ++) {\n", threadNum);
+  emitBodyLock(2, "threadDone[i * THREAD_PAD] = 0;\n");
+  emitBodyLock(2, "threads[i] = std::thread(&S%s::threadWorker, this, i);\n", name.c_str());
+  emitBodyLock(1, "}\n");
+  emitBodyLock(0, "}\n");
+
+  emitFuncDecl(0, "S%s::~S%s() {\n", name.c_str(), name.c_str());
+  emitBodyLock(1, "__atomic_store_n(&threadEpoch, THREAD_EXIT, __ATOMIC_RELEASE);\n");
+  emitBodyLock(1, "for (int i = 1; i < %d; i ++) threads[i].join();\n", threadNum);
+  emitBodyLock(0, "}\n");
+}
+
 void graph::genResetDef(SuperNode* super, bool isUIntReset, int indent) {
-  emitBodyLock(indent ++, "void S%s::subReset%d(){ // %s reset\n", name.c_str(), resetFuncNum, isUIntReset ? "uint" : "async");
+  emitBodyLock(indent ++, "void S%s::subReset%d(%s){ // %s reset\n", name.c_str(), resetFuncNum, isLaneMode() ? "int lane" : "", isUIntReset ? "uint" : "async");
+  int bodyIndent = indent;
+  beginLaneBlock();
   if (super2ResetId.find(super->resetNode) != super2ResetId.end()) {
     super2ResetId[super->resetNode] = std::make_pair(-1, -1);
   }
@@ -664,11 +1425,12 @@ void graph::genResetDef(SuperNode* super, bool isUIntReset, int indent) {
         break;
     }
   }
+  endLaneBlock(bodyIndent, false);
   emitBodyLock(-- indent, "}\n");
 }
 
 void graph::genResetActivation(SuperNode* super, bool isUIntReset, int indent, int resetId) {
-  emitBodyLock(indent, "subReset%d();\n", resetId);
+  emitBodyLock(indent, "subReset%d(%s);\n", resetId, laneArg().c_str());
 }
 
 void graph::genResetAll() {
@@ -683,35 +1445,250 @@ void graph::genResetAll() {
   }
 
   emitFuncDecl(0, "void S%s::resetAll(){\n", name.c_str());
+  int indent = 1;
+  if (isLaneMode()) emitBodyLock(indent ++, "for (int lane = 0; lane < GSIM_LANES; lane ++) {\n");
   for (size_t i = 0; i < resetSuper.size(); i ++) {
     if (resetSuper[i]->superType == SUPER_ASYNC_RESET) continue;
-    genResetActivation(resetSuper[i], true, 1, i);
+    genResetActivation(resetSuper[i], true, indent, i);
   }
+  if (isLaneMode()) emitBodyLock(-- indent, "}\n");
   emitBodyLock(0, "}\n");
 }
 
+void graph::genStateSnapshot(FILE* header) {
+  hashStateLayout(format("cycles uint64_t; activeFlags uint%d_t[%d]", ACTIVE_WIDTH, activeFlagNum));
+  if (useActiveSummary()) hashStateLayout(format("activeSummary uint64_t[%d]", activeSummaryNum));
+  fprintf(header, "static const uint64_t STATE_LAYOUT_HASH = 0x%lxUL;\n", stateLayoutHash);
+  fprintf(header, "size_t stateSize();\n");
+  fprintf(header, "void saveState(std::vector<uint8_t>& buf);\n");
+  fprintf(header, "bool loadState(const uint8_t* buf, size_t size);\n");
+  fprintf(header, "#ifdef GSIM_STATE_ZSTD\n");
+  fprintf(header, "bool saveState(const char* path);\n");
+  fprintf(header, "bool loadState(const char* path);\n");
+  fprintf(header, "#endif\n");
+
+  /* payload: cycles, activeFlags, activeSummary, [_var_start, _var_end) */
+  std::vector<std::string> fields = {"&cycles, sizeof(cycles)", "activeFlags, sizeof(activeFlags)"};
+  if (useActiveSummary()) fields.push_back("activeSummary, sizeof(activeSummary)");
+  fields.push_back("&_var_start, (char*)&_var_end - (char*)&_var_start");
+  size_t denseFields = fields.size();
+  std::string sparseSize;
+  for (SparseMemory& sparse : sparseMemory) {
+    fields.push_back(format("%s, sizeof(%s)", sparse.node->name.c_str(), sparse.node->name.c_str()));
+    sparseSize += format(" + sizeof(%s)", sparse.node->name.c_str());
+  }
+
+  emitFuncDecl(0, "size_t S%s::stateSize() {\n"
+               "  return sizeof(GSIMStateHeader) + sizeof(cycles) + sizeof(activeFlags)%s + ((char*)&_var_end - (char*)&_var_start)%s;\n"
+               "}\n", name.c_str(), useActiveSummary() ? " + sizeof(activeSummary)" : "", sparseSize.c_str());
+
+  emitFuncDecl(0, "void S%s::saveState(std::vector<uint8_t>& buf) {\n"
+               "  buf.resize(stateSize());\n"
+               "  GSIMStateHeader* stateHeader = (GSIMStateHeader*)buf.data();\n"
+               "  memcpy(stateHeader->magic, GSIM_STATE_MAGIC, sizeof(stateHeader->magic));\n"
+               "  stateHeader->version = GSIM_STATE_VERSION;\n"
+               "  stateHeader->reserved = 0;\n"
+               "  stateHeader->layoutHash = STATE_LAYOUT_HASH;\n"
+               "  stateHeader->size = buf.size() - sizeof(GSIMStateHeader);\n"
+               "  uint8_t* ptr = buf.data() + sizeof(GSIMStateHeader);\n", name.c_str());
+  for (std::string field : fields) {
+    std::string src = field.substr(0, field.find(", "));
+    std::string size = field.substr(field.find(", ") + 2);
+    emitBodyLock(1, "memcpy(ptr, %s, %s); ptr += %s;\n", src.c_str(), size.c_str(), size.c_str());
+  }
+  emitBodyLock(0, "}\n");
+
+  emitFuncDecl(0, "bool S%s::loadState(const uint8_t* buf, size_t size) {\n"
+               "  const GSIMStateHeader* stateHeader = (const GSIMStateHeader*)buf;\n"
+               "  if (size < sizeof(GSIMStateHeader) || memcmp(stateHeader->magic, GSIM_STATE_MAGIC, sizeof(stateHeader->magic)) != 0) {\n"
+               "    fprintf(stderr, \"[loadState] not a state snapshot of gsim\\n\");\n"
+               "    return false;\n"
+               "  }\n"
+               "  if (stateHeader->version != GSIM_STATE_VERSION) {\n"
+               "    fprintf(stderr, \"[loadState] unsupported snapshot version %%d (expected %%d)\\n\", stateHeader->version, GSIM_STATE_VERSION);\n"
+               "    return false;\n"
+               "  }\n"
+               "  if (stateHeader->layoutHash != STATE_LAYOUT_HASH || size != stateSize() || stateHeader->size != size - sizeof(GSIMStateHeader)) {\n"
+               "    fprintf(stderr, \"[loadState] snapshot layout %%lx does not match the model layout %%lx\\n\", stateHeader->layoutHash, STATE_LAYOUT_HASH);\n"
+               "    return false;\n"
+               "  }\n"
+               "  const uint8_t* ptr = buf + sizeof(GSIMStateHeader);\n", name.c_str());
+  for (size_t i = 0; i < fields.size(); i ++) {
+    std::string dst = fields[i].substr(0, fields[i].find(", "));
+    std::string size = fields[i].substr(fields[i].find(", ") + 2);
+    /* page-backed memories only map the pages with nonzero data */
+    if (i >= denseFields) emitBodyLock(1, "%s$pages.load(ptr); ptr += %s;\n", dst.c_str(), size.c_str());
+    else emitBodyLock(1, "memcpy(%s, ptr, %s); ptr += %s;\n", dst.c_str(), size.c_str(), size.c_str());
+  }
+  emitBodyLock(1, "return true;\n");
+  emitBodyLock(0, "}\n");
+
+  /* files are zstd frames of the in-memory snapshot, built with -DGSIM_STATE_ZSTD */
+  emitFuncDecl(0, "#ifdef GSIM_STATE_ZSTD\n"
+               "bool S%s::saveState(const char* path) {\n"
+               "  std::vector<uint8_t> buf;\n"
+               "  saveState(buf);\n"
+               "  std::vector<uint8_t> compressed(ZSTD_compressBound(buf.size()));\n"
+               "  size_t len = ZSTD_compress(compressed.data(), compressed.size(), buf.data(), buf.size(), GSIM_STATE_ZSTD_LEVEL);\n"
+               "  if (ZSTD_isError(len)) {\n"
+               "    fprintf(stderr, \"[saveState] %%s\\n\", ZSTD_getErrorName(len));\n"
+               "    return false;\n"
+               "  }\n"
+               "  FILE* fp = fopen(path, \"wb\");\n"
+               "  if (!fp) {\n"
+               "    fprintf(stderr, \"[saveState] can not open %%s\\n\", path);\n"
+               "    return false;\n"
+               "  }\n"
+               "  bool ret = fwrite(compressed.data(), 1, len, fp) == len;\n"
+               "  ret = (fclose(fp) == 0) && ret;\n"
+               "  return ret;\n"
+               "}\n"
+               "#endif\n", name.c_str());
+
+  emitFuncDecl(0, "#ifdef GSIM_STATE_ZSTD\n"
+               "bool S%s::loadState(const char* path) {\n"
+               "  FILE* fp = fopen(path, \"rb\");\n"
+               "  if (!fp) {\n"
+               "    fprintf(stderr, \"[loadState] can not open %%s\\n\", path);\n"
+               "    return false;\n"
+               "  }\n"
+               "  fseek(fp, 0, SEEK_END);\n"
+               "  long len = ftell(fp);\n"
+               "  fseek(fp, 0, SEEK_SET);\n"
+               "  std::vector<uint8_t> compressed(len > 0 ? len : 0);\n"
+               "  bool readDone = len > 0 && fread(compressed.data(), 1, len, fp) == (size_t)len;\n"
+               "  fclose(fp);\n"
+               "  unsigned long long size = readDone ? ZSTD_getFrameContentSize(compressed.data(), compressed.size()) : ZSTD_CONTENTSIZE_ERROR;\n"
+               "  if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN) {\n"
+               "    fprintf(stderr, \"[loadState] %%s is not a zstd compressed snapshot\\n\", path);\n"
+               "    return false;\n"
+               "  }\n"
+               "  std::vector<uint8_t> buf(size);\n"
+               "  size_t ret = ZSTD_decompress(buf.data(), buf.size(), compressed.data(), compressed.size());\n"
+               "  if (ZSTD_isError(ret) || ret != size) {\n"
+               "    fprintf(stderr, \"[loadState] fail to decompress %%s\\n\", path);\n"
+               "    return false;\n"
+               "  }\n"
+               "  return loadState(buf.data(), buf.size());\n"
+               "}\n"
+               "#endif\n", name.c_str());
+}
+
 void graph::genStep(int subStepIdxMax) {
   emitFuncDecl(0, "void S%s::step() {\n", name.c_str());
   emitBodyLock(1, "resetAll();\n");
+  beginLaneBlock();
   for (SuperNode* super : sortedSuper) {
     for (Node* member : super->member) {
       if (member->isReset() && member->type == NODE_REG_SRC) {
-        emitBodyLock(1, "%s = %s;\n", RESET_NAME(member).c_str(), member->name.c_str());
+        emitBodyLock(isLaneMode() ? 2 : 1, "%s = %s;\n", RESET_NAME(member).c_str(), member->name.c_str());
       }
     }
   }
-  for (int i = 0; i <= subStepIdxMax; i ++) {
-    emitBodyLock(1, "subStep%d();\n", i);
+  endLaneBlock(1, true);
+  if (globalConfig.InstrumentActivity) {
+    emitBodyLock(1, "activitySampling = ++ activityTick >= activityInterval;\n");
+    emitBodyLock(1, "if (unlikely(activitySampling)) {\n");
+    emitBodyLock(2, "activityTick = 0;\n");
+    emitBodyLock(2, "activitySamples ++;\n");
+    emitBodyLock(1, "}\n");
+  }
+  if (isThreaded()) {
+    /* thread 0 is the caller of step() */
+    emitBodyLock(1, "memset(threadProgress, 0, sizeof(threadProgress));\n");
+    emitBodyLock(1, "uint64_t epoch = threadEpoch + 1;\n");
+    emitBodyLock(1, "__atomic_store_n(&threadEpoch, epoch, __ATOMIC_RELEASE);\n");
+    emitBodyLock(1, "threadStep0();\n");
+    emitBodyLock(1, "for (int i = 1; i < %d; i ++) {\n", globalConfig.ThreadNum);
+    emitBodyLock(2, "THREAD_SPIN(__atomic_load_n(&threadDone[i * THREAD_PAD], __ATOMIC_ACQUIRE) != epoch);\n");
+    emitBodyLock(1, "}\n");
+  } else {
+    for (int i = 0; i <= subStepIdxMax; i ++) {
+      emitBodyLock(1, "subStep%d();\n", i);
+    }
   }
 
   emitBodyLock(1, "cycles ++;\n");
   emitBodyLock(0, "}\n");
 }
 
+/*
+  activity instrumentation: every activityInterval cycles, each flag word is sampled when it is
+  visited, before its superNodes clear it, and every set bit adds one to the counter of its superNode.
+  Other cycles only pay for the test of activitySampling once per visited word, and the profiled
+  model runs the optimized code. The profile maps superNodes to the names of their members
+*/
+void graph::genActivityProfile(FILE* header) {
+  fprintf(header, "uint64_t activityCounts[%d];\n", activeFlagNum * ACTIVE_WIDTH);
+  fprintf(header, "uint64_t activitySamples;\n");
+  fprintf(header, "uint32_t activityInterval;\n");
+  fprintf(header, "uint32_t activityTick;\n");
+  fprintf(header, "bool activitySampling;\n");
+  fprintf(header, "void resetActivity();\n");
+  fprintf(header, "void setActivityInterval(uint32_t interval);\n");
+  fprintf(header, "size_t activityNum() { return %d; }\n", superId);
+  fprintf(header, "const char* activityName(int id);\n");
+  fprintf(header, "uint64_t activityCount(int id) { return activityCounts[id]; }\n");
+  fprintf(header, "__attribute__((cold, noinline)) void sampleActivity(int word, uint64_t flags) {\n"
+                  "  for (; flags != 0; flags &= flags - 1) activityCounts[word * %d + __builtin_ctzll(flags)] ++;\n"
+                  "}\n", ACTIVE_WIDTH);
+  fprintf(header, "uint64_t activitySampledCycles() { return activitySamples; }\n");
+  fprintf(header, "bool writeActivityProfile(const char* path);\n");
+
+  emitFuncDecl(0, "void S%s::resetActivity() {\n"
+               "  memset(activityCounts, 0, sizeof(activityCounts));\n"
+               "  activitySamples = 0;\n"
+               "  activityTick = 0;\n"
+               "  activitySampling = false;\n"
+               "  activityInterval = GSIM_ACTIVITY_INTERVAL;\n"
+               "}\n", name.c_str());
+  emitFuncDecl(0, "void S%s::setActivityInterval(uint32_t interval) {\n"
+               "  activityInterval = interval == 0 ? 1 : interval;\n"
+               "}\n", name.c_str());
+
+  emitFuncDecl(0, "const char* S%s::activityName(int id) {\n", name.c_str());
+  emitBodyLock(1, "static const char* const names[] = {\n");
+  for (int id = 0; id < superId; id ++) {
+    std::string names;
+    for (Node* member : cppId2Super[id]->member) names += (names.empty() ? "" : " ") + member->name;
+    emitBodyLock(2, "\"%s\", // id=%d\n", names.c_str(), id);
+  }
+  emitBodyLock(1, "};\n");
+  emitBodyLock(1, "return (id >= 0 && id < %d) ? names[id] : \"\";\n", superId);
+  emitBodyLock(0, "}\n");
+
+  emitFuncDecl(0, "bool S%s::writeActivityProfile(const char* path) {\n"
+               "  FILE* fp = fopen(path, \"wb\");\n"
+               "  if (!fp) {\n"
+               "    fprintf(stderr, \"[writeActivityProfile] cannot open %%s\\n\", path);\n"
+               "    return false;\n"
+               "  }\n"
+               "  GSIMActivityHeader activityHeader;\n"
+               "  memcpy(activityHeader.magic, GSIM_ACTIVITY_MAGIC, sizeof(activityHeader.magic));\n"
+               "  activityHeader.version = GSIM_ACTIVITY_VERSION;\n"
+               "  activityHeader.superNum = activityNum();\n"
+               "  activityHeader.cycles = activitySamples;\n"
+               "  activityHeader.interval = activityInterval;\n"
+               "  bool ok = fwrite(&activityHeader, sizeof(activityHeader), 1, fp) == 1;\n"
+               "  for (size_t i = 0; ok && i < activityNum(); i ++) {\n"
+               "    const char* names = activityName(i);\n"
+               "    uint32_t nameLen = strlen(names);\n"
+               "    ok = fwrite(&activityCounts[i], sizeof(uint64_t), 1, fp) == 1 && fwrite(&nameLen, sizeof(nameLen), 1, fp) == 1 &&\n"
+               "         fwrite(names, 1, nameLen, fp) == nameLen;\n"
+               "  }\n"
+               "  return fclose(fp) == 0 && ok;\n"
+               "}\n", name.c_str());
+}
+
 bool SuperNode::instsEmpty() {
   return insts.size() == 0;
 }
 
+/* superNodes emitted with a cppId and an activeFlags bit */
+bool SuperNode::hasCode() {
+  return !instsEmpty() || superType == SUPER_EXTMOD || superType == SUPER_ASYNC_RESET;
+}
+
 bool graph::__emitSrc(int indent, bool canNewFile, bool alreadyEndFunc, const char *nextFuncDef, const char *fmt, ...) {
   bool newFile = false;
   if (srcFp == NULL || (srcFileBytes > (globalConfig.cppMaxSizeKB * 1024) && canNewFile)) {
@@ -738,6 +1715,46 @@ bool graph::__emitSrc(int indent, bool canNewFile, bool alreadyEndFunc, const ch
   return newFile;
 }
 
+/*
+  lane blocks: the code emitted between beginLaneBlock() and endLaneBlock() runs once per lane,
+  with every state variable bound to its lane. The lanes share the flag scan and the superNode
+  schedule, not the datapath: the loop bodies keep their activation branches, so they are
+  scalar code and --lanes only consolidates processes
+*/
+void graph::beginLaneBlock() {
+  if (!isLaneMode()) return;
+  Assert(laneOuterFp == NULL, "nested lane blocks");
+  laneOuterFp = srcFp;
+  srcFp = open_memstream(&laneBuf, &laneBufSize);
+  Assert(srcFp != NULL, "fail to open the lane block buffer");
+}
+
+void graph::endLaneBlock(int indent, bool loop) {
+  if (!isLaneMode()) return;
+  fclose(srcFp);
+  srcFp = laneOuterFp;
+  laneOuterFp = NULL;
+  /* bind the state variables used in this block */
+  std::set<std::string> used;
+  for (size_t i = 0; i < laneBufSize; ) {
+    size_t j = i;
+    while (j < laneBufSize && (isalnum(laneBuf[j]) || laneBuf[j] == '_' || laneBuf[j] == '$')) j ++;
+    if (j == i) { i ++; continue; }
+    std::string id(laneBuf + i, j - i);
+    if (!isdigit(laneBuf[i]) && laneStateNames.find(id) != laneStateNames.end()) used.insert(id);
+    i = j;
+  }
+  if (laneBufSize != 0) {
+    if (loop) emitBodyLock(indent ++, "for (int lane = 0; lane < GSIM_LANES; lane ++) {\n");
+    for (std::string id : used) emitBodyLock(indent, "auto& %s = this->%s[lane];\n", id.c_str(), id.c_str());
+    fwrite(laneBuf, 1, laneBufSize, srcFp);
+    if (loop) emitBodyLock(-- indent, "}\n");
+  }
+  free(laneBuf);
+  laneBuf = NULL;
+  laneBufSize = 0;
+}
+
 void graph::emitPrintf() {
   emitFuncDecl(0, "void gprintf(const char *fmt, ...) {\n");
   emitBodyLock(0,
@@ -771,9 +1788,191 @@ void graph::emitPrintf() {
   );
 }
 
+/*
+  superNodes activated in most cycles are evaluated unconditionally: they skip the flag test,
+  and their predecessors neither back up old values nor compare them to activate them
+  superNodes with printf/assert or memory writers keep their activation, as evaluating them
+  again is not idempotent
+*/
+static bool canAlwaysActive(SuperNode* super) {
+  if (super->superType != SUPER_VALID) return false;
+  for (Node* member : super->member) {
+    if (member->type == NODE_SPECIAL || member->type == NODE_WRITER || member->type == NODE_READWRITER) return false;
+  }
+  return true;
+}
+
+void graph::selectAlwaysActive() {
+  int num = 0;
+  for (int id = 0; id < superId; id ++) {
+    SuperNode* super = cppId2Super[id];
+    if (isAlwaysActive(id) || !canAlwaysActive(super)) continue;
+    /* the superNode is activated at least as often as its most active member */
+    double rate = 0;
+    for (Node* member : super->member) rate = MAX(rate, nodeActivity(member).activeRate);
+    if (rate < globalConfig.AlwaysActiveRatio) continue;
+    alwaysActive.insert(id);
+    num ++;
+  }
+  printf("[cppEmitter] %d superNodes are always active (activation ratio >= %.2lf)\n", num, globalConfig.AlwaysActiveRatio);
+}
+
+/* superNodes only activated by reset signals (or never after the initial activation) */
+static bool isResetOnly(SuperNode* super) {
+  if (super->superType == SUPER_ASYNC_RESET) return true;
+  for (Node* member : super->member) {
+    if (member->status != VALID_NODE) continue;
+    /* activated by registers, memory writers and inputs without a prev edge */
+    if (member->type == NODE_REG_SRC || member->type == NODE_INP || member->type == NODE_READER ||
+        member->type == NODE_READWRITER || member->type == NODE_EXT_OUT) return false;
+    for (Node* prev : member->prev) {
+      if (prev->super != super && !prev->isReset()) return false;
+    }
+  }
+  return true;
+}
+
+void graph::selectColdSuper() {
+  for (int id = 0; id < superId; id ++) {
+    SuperNode* super = cppId2Super[id];
+    if (isAlwaysActive(id) || super->superType == SUPER_EXTMOD || super->insts.size() < COLD_MIN_INSTS) continue;
+    if (hasActivityProfile()) {
+      double rate = 0;
+      for (Node* member : super->member) rate = MAX(rate, nodeActivity(member).activeRate);
+      if (rate >= globalConfig.ColdRatio) continue;
+    } else if (!isResetOnly(super)) continue;
+    coldSuper.insert(id);
+  }
+  if (hasActivityProfile()) printf("[cppEmitter] %ld superNodes are outlined as cold (activation ratio < %.4lf)\n", coldSuper.size(), globalConfig.ColdRatio);
+  else printf("[cppEmitter] %ld superNodes only activated by reset are outlined as cold\n", coldSuper.size());
+}
+
+/*
+  rarely activated superNodes are evaluated by cold functions (placed in .text.unlikely by the compiler)
+  instead of inline in the subSteps, so the scan loop stays dense in the i-cache
+  the flag word being scanned is passed by reference for the activations inside the same word
+*/
+void graph::genColdSuper(FILE* header) {
+  for (int id : coldSuper) {
+    fprintf(header, "__attribute__((cold, noinline)) void coldSuper%d(uint%d_t& flag);\n", id, ACTIVE_WIDTH);
+    emitFuncDecl(0, "void S%s::coldSuper%d(uint%d_t& flag) {\n", name.c_str(), id, ACTIVE_WIDTH);
+    genSuperEval(cppId2Super[id], "flag", 1);
+    emitBodyLock(0, "}\n");
+  }
+}
+
+/*
+  lazy outputs: superNodes computing nothing but top-level outputs are not evaluated by step()
+  their cppIds are placed after all other superNodes, so the activations still set their flags,
+  which are only tested and cleared by the getters
+*/
+static bool isLazyOutputSuper(SuperNode* super) {
+  if (super->superType != SUPER_VALID || !super->hasCode()) return false;
+  bool anyOutput = false;
+  for (Node* member : super->member) {
+    if (member->status != VALID_NODE) continue;
+    if (!lazyOutputMember(member)) return false;
+    if (member->type == NODE_OUT) anyOutput = true;
+    for (Node* next : member->next) {
+      if (next->super != super || super->findIndex(next) <= super->findIndex(member)) return false;
+    }
+  }
+  return anyOutput;
+}
+
+void graph::selectLazySuper() {
+#ifndef DIFFTEST_PER_SIG // the signals are compared as members after every step
+  size_t outputNum = 0;
+  for (SuperNode* super : sortedSuper) {
+    if (!isLazyOutputSuper(super)) continue;
+    lazySuper.insert(super);
+    for (Node* member : super->member) outputNum += member->type == NODE_OUT && member->status == VALID_NODE;
+  }
+  printf("[cppEmitter] %ld superNodes computing %ld outputs are evaluated on demand\n", lazySuper.size(), outputNum);
+#endif
+}
+
+void graph::genLazySuper(FILE* header) {
+  for (SuperNode* super : lazySuper) {
+    int id;
+    uint64_t mask;
+    std::tie(id, mask) = setIdxMask(super->cppId);
+    fprintf(header, "void lazySuper%d();\n", super->cppId);
+    emitFuncDecl(0, "void S%s::lazySuper%d() {\n", name.c_str(), super->cppId);
+    emitBodyLock(1, "activeFlags[%d] &= 0x%lx;\n", id, ~mask & flagWordMask());
+    genSuperEval(super, format("activeFlags[%d]", id), 1);
+    emitBodyLock(0, "}\n");
+  }
+}
+
+/*
+  run(): step the model up to maxCycles cycles and return the number of cycles evaluated
+  watchChanged collects the watched outputs changed in the evaluated superNodes, so the
+  harness callback and the nonzero checks only run in cycles where a watched output changes
+*/
+void graph::genRun(FILE* header) {
+  fprintf(header, "uint32_t stopMask; // events returned by run() instead of ending the process\n");
+  fprintf(header, "uint32_t stopCause; // GSIM_STOP_* events ending the last run()\n");
+  fprintf(header, "int exitCode;\n");
+  fprintf(header, "uint64_t watchChanged;\n");
+  fprintf(header, "void (*watchCallback)(S%s* model, uint64_t changed, void* arg);\n", name.c_str());
+  fprintf(header, "void* watchArg;\n");
+  if (!watchIdx.empty()) {
+    std::vector<Node*> watched(watchIdx.size());
+    for (auto iter : watchIdx) watched[iter.second] = iter.first;
+    fprintf(header, "enum {");
+    for (size_t i = 0; i < watched.size(); i ++) fprintf(header, "%s WATCH_%s = %ld", i == 0 ? "" : ",", watched[i]->name.c_str(), i);
+    fprintf(header, " };\n");
+  }
+  fprintf(header, "uint64_t watchNonzero();\n");
+  fprintf(header, "uint64_t run(uint64_t maxCycles, StopMask mask);\n");
+
+  emitFuncDecl(0, "uint64_t S%s::watchNonzero() {\n", name.c_str());
+  emitBodyLock(1, "uint64_t nonzero = 0;\n");
+  for (auto iter : watchIdx) {
+    if (isLaneMode()) emitBodyLock(1, "for (int lane = 0; lane < GSIM_LANES; lane ++) nonzero |= (uint64_t)(get_%s(lane) != 0) << %d;\n", iter.first->name.c_str(), iter.second);
+    else emitBodyLock(1, "nonzero |= (uint64_t)(get_%s() != 0) << %d;\n", iter.first->name.c_str(), iter.second);
+  }
+  emitBodyLock(1, "return nonzero;\n");
+  emitBodyLock(0, "}\n");
+
+  emitFuncDecl(0, "uint64_t S%s::run(uint64_t maxCycles, StopMask mask) {\n", name.c_str());
+  emitBodyLock(1, "stopMask = mask.events;\n");
+  emitBodyLock(1, "stopCause = 0;\n");
+  emitBodyLock(1, "uint64_t n = 0;\n");
+  emitBodyLock(1, "while (n < maxCycles) {\n");
+  emitBodyLock(2, "watchChanged = 0;\n");
+  emitBodyLock(2, "step();\n");
+  emitBodyLock(2, "n ++;\n");
+  emitBodyLock(2, "if (unlikely(watchChanged != 0)) {\n");
+  emitBodyLock(3, "if (watchCallback) watchCallback(this, watchChanged, watchArg);\n");
+  emitBodyLock(3, "if (mask.nonzero & watchChanged & watchNonzero()) stopCause |= GSIM_STOP_OUTPUT;\n");
+  emitBodyLock(2, "}\n");
+  emitBodyLock(2, "if (unlikely(stopCause != 0)) break;\n");
+  emitBodyLock(1, "}\n");
+  emitBodyLock(1, "if (stopCause == 0) stopCause = GSIM_STOP_CYCLES;\n");
+  emitBodyLock(1, "stopMask = 0;\n");
+  emitBodyLock(1, "return n;\n");
+  emitBodyLock(0, "}\n");
+}
+
 void graph::cppEmitter() {
+  for (std::string watchName : globalConfig.WatchOutputs) {
+    Node* watched = nullptr;
+    for (Node* node : output) {
+      if (node->name == watchName) watched = node;
+    }
+    if (!watched || watched->isArray()) printf("[cppEmitter] --watch-outputs: %s is not a scalar output, ignored\n", watchName.c_str());
+    else if (watchIdx.size() == 64) printf("[cppEmitter] --watch-outputs: at most 64 outputs are watched, %s is ignored\n", watchName.c_str());
+    else if (!isWatched(watched)) {
+      int idx = watchIdx.size();
+      watchIdx[watched] = idx;
+    }
+  }
+  if (globalConfig.LazyOutputs) selectLazySuper();
+
   for (SuperNode* super : sortedSuper) {
-    if (!super->instsEmpty() || super->superType == SUPER_EXTMOD || super->superType == SUPER_ASYNC_RESET) {
+    if (super->hasCode() && lazySuper.find(super) == lazySuper.end()) {
       super->cppId = superId ++;
       cppId2Super[super->cppId] = super;
       if (super->superType == SUPER_EXTMOD) {
@@ -787,19 +1986,40 @@ void graph::cppEmitter() {
 #endif
     }
   }
-  activeFlagNum = (superId + ACTIVE_WIDTH - 1) / ACTIVE_WIDTH;
+  if (globalConfig.AlwaysActiveRatio >= 0) {
+    if (hasActivityProfile()) selectAlwaysActive();
+    else printf("[cppEmitter] --always-active-ratio is ignored without --activity-profile\n");
+  }
+  if (globalConfig.ColdRatio >= 0) selectColdSuper();
+  int lazyId = ROUNDUP(superId, ACTIVE_WIDTH);
+  if (!lazySuper.empty()) lazyWordBase = lazyId / ACTIVE_WIDTH;
+  for (SuperNode* super : sortedSuper) {
+    if (lazySuper.find(super) == lazySuper.end()) continue;
+    super->cppId = lazyId ++;
+    cppId2Super[super->cppId] = super;
+  }
+  activeFlagNum = (lazyId + ACTIVE_WIDTH - 1) / ACTIVE_WIDTH;
   // avoid buffer overflow when accessing the last elements as uint64_t
   activeFlagNum = ROUNDUP(activeFlagNum, 8);
+  activeSummaryNum = (activeFlagNum + SUMMARY_WIDTH - 1) / SUMMARY_WIDTH;
 
+  std::set<int> noAlwaysActive; // see tracksAlwaysActive()
   for (SuperNode* super : sortedSuper) {
     for (Node* member : super->member) {
       if (member->status == VALID_NODE) {
         member->updateActivate();
-        member->updateNeedActivate(alwaysActive);
+        member->updateNeedActivate(globalConfig.SkipIdle ? noAlwaysActive : alwaysActive);
       }
     }
   }
 
+  if (isThreaded()) {
+    std::vector<SuperNode*> emitSuper;
+    for (int i = 0; i < superId; i ++) emitSuper.push_back(cppId2Super[i]);
+    threadPartition(emitSuper);
+  }
+
+
   srcFp = NULL;
   srcFileIdx = 0;
 
@@ -812,43 +2032,33 @@ void graph::cppEmitter() {
   fprintf(header, "class S%s {\npublic:\n", name.c_str());
   fprintf(header, "uint64_t cycles;\n");
   fprintf(header, "uint64_t LOG_START, LOG_END;\n");
-  fprintf(header, "uint%d_t activeFlags[%d];\n", ACTIVE_WIDTH, activeFlagNum); // or super.size() if id == idx
-#ifdef PERF
-  fprintf(header, "size_t activeTimes[%d];\n", superId);
-#if ENABLE_ACTIVATOR
-  fprintf(header, "std::map<int, int>activator[%d];\n", superId);
-#endif
-  fprintf(header, "size_t validActive[%d];\n", superId);
-  fprintf(header, "size_t nodeNum[%d];\n", superId);
-#endif
+  fprintf(header, "%suint%d_t activeFlags[%d];\n", isThreaded() ? "alignas(64) " : "", ACTIVE_WIDTH, activeFlagNum); // or super.size() if id == idx
+  if (useActiveSummary()) fprintf(header, "uint64_t activeSummary[%d];\n", activeSummaryNum);
+  if (isThreaded()) {
+    fprintf(header, "std::thread threads[%d];\n", globalConfig.ThreadNum);
+    fprintf(header, "uint64_t threadEpoch;\n");
+    fprintf(header, "alignas(64) uint64_t threadDone[%d * THREAD_PAD];\n", globalConfig.ThreadNum);
+    fprintf(header, "alignas(64) uint64_t threadProgress[%d * THREAD_PAD];\n", globalConfig.ThreadNum);
+  }
   emitPrintf();
   /* constrcutor */
   emitFuncDecl(0, "S%s::S%s() {\n"
                "  cycles = 0;\n"
                "  LOG_START = 1;\n"
                "  LOG_END = 0;\n"
-               "  init();\n"
-               "}\n", name.c_str(), name.c_str());
+               "  stopMask = stopCause = 0;\n"
+               "  exitCode = 0;\n"
+               "  watchChanged = 0;\n"
+               "  watchCallback = NULL;\n"
+               "  watchArg = NULL;\n"
+               "  init();\n", name.c_str(), name.c_str());
+  if (isThreaded()) emitBodyLock(1, "startThreads();\n");
+  emitBodyLock(0, "}\n");
 
   /* initialization */
   emitFuncDecl(0, "void S%s::init() {\n", name.c_str());
   emitBodyLock(1, "activateAll();\n");
-#ifdef PERF
-  emitBodyLock(1, "for (int i = 0; i < %d; i ++) activeTimes[i] = 0;\n", superId);
-  #if ENABLE_ACTIVATOR
-  emitBodyLock(1, "for (int i = 0; i < %d; i ++) activator[i] = std::map<int, int>();\n", superId);
-  #endif
-  for (SuperNode* super : sortedSuper) {
-    if (super->cppId >= 0) {
-      size_t num = 0;
-      for (Node* member : super->member) {
-        if (member->anyNextActive()) num ++;
-      }
-      emitBodyLock(1, "nodeNum[%d] = %ld; // memberNum=%ld\n", super->cppId, num, super->member.size());
-    }
-  }
-  emitBodyLock(1, "for (int i = 0; i < %d; i ++) validActive[i] = 0;\n", superId);
-#endif
+  if (globalConfig.InstrumentActivity) emitBodyLock(1, "resetActivity();\n");
   emitBodyLock(0, "#ifdef RANDOMIZE_INIT\n"
                "  srand((unsigned int)time(NULL));\n"
                "  for (uint32_t *p = &_var_start; p != &_var_end; p ++) {\n"
@@ -858,6 +2068,7 @@ void graph::cppEmitter() {
 
   // header: node definition; src: node evaluation
   fprintf(header, "uint32_t _var_start;\n");
+  beginLaneBlock();
   for (SuperNode* super : sortedSuper) {
     // std::string insts;
     if (super->superType == SUPER_VALID || super->superType == SUPER_ASYNC_RESET) {
@@ -869,14 +2080,17 @@ void graph::cppEmitter() {
   }
   /* memory definition */
   for (Node* mem : memory) genNodeDef(header, mem);
+  genStateLayout(header);
   fprintf(header, "uint32_t _var_end;\n");
+  endLaneBlock(1, true);
 
   emitBodyLock(0, "// initialize registers with reset value 0 to overwrite the rand() results\n" );
-  emitBodyLock(1, "memset(&_var_start, 0, &_var_end - &_var_start);\n");
+  emitBodyLock(1, "memset(&_var_start, 0, (char*)&_var_end - (char*)&_var_start);\n");
 
   emitBodyLock(0, "#else\n" // RANDOMIZE_INIT
-               "  memset(&_var_start, 0, &_var_end - &_var_start);\n"
+               "  memset(&_var_start, 0, (char*)&_var_end - (char*)&_var_start);\n"
                "#endif\n");
+  genSparseMemory(header);
 
   fprintf(header, "S%s();\n", name.c_str());
   fprintf(header, "void init();\n");
@@ -885,17 +2099,34 @@ void graph::cppEmitter() {
 
   /* activation all nodes for reset */
   fprintf(header, "void activateAll();\n");
-  emitFuncDecl(0, "void S%s::activateAll() {\n"
-               "  memset(activeFlags, 0xff, sizeof(activeFlags));\n"
-               "}\n", name.c_str());
+  if (isThreaded()) {
+    emitFuncDecl(0, "void S%s::activateAll() {\n"
+                 "  for (size_t i = 0; i < sizeof(activeFlags) / sizeof(activeFlags[0]); i ++) {\n"
+                 "    __atomic_store_n(&activeFlags[i], (uint%d_t)-1, __ATOMIC_RELAXED);\n"
+                 "  }\n"
+                 "}\n", name.c_str(), ACTIVE_WIDTH);
+  } else {
+    emitFuncDecl(0, "void S%s::activateAll() {\n"
+                 "  memset(activeFlags, 0xff, sizeof(activeFlags));\n"
+                 "  memset(activeSummary, 0xff, sizeof(activeSummary));\n"
+                 "}\n", name.c_str());
+  }
+
+  /* state snapshot */
+  genStateSnapshot(header);
+
+  if (globalConfig.InstrumentActivity) genActivityProfile(header);
+
+  if (globalConfig.SkipIdle) genSkipIdle(header);
 
    /* input/output interface */
   for (Node* node : input) {
     fprintf(header, "void set_%s(%s val);\n", node->name.c_str(), widthUType(node->width).c_str());
+    if (isLaneMode()) fprintf(header, "void set_%s(int lane, %s val);\n", node->name.c_str(), widthUType(node->width).c_str());
     genInterfaceInput(node);
   }
   for (Node* node : output) {
-    fprintf(header, "%s get_%s();\n", widthUType(node->width).c_str(), node->name.c_str());
+    fprintf(header, "%s get_%s(%s);\n", widthUType(node->width).c_str(), node->name.c_str(), isLaneMode() ? "int lane = 0" : "");
     genInterfaceOutput(node);
   }
 
@@ -903,18 +2134,35 @@ void graph::cppEmitter() {
   fprintf(header, "void resetAll();\n");
   genResetAll();
   for (int i = 0; i < resetFuncNum; i ++) {
-    fprintf(header, "void subReset%d();\n", i);
+    fprintf(header, "void subReset%d(%s);\n", i, isLaneMode() ? "int lane" : "");
   }
 
   /* main evaluation loop (step) */
-  int subStepIdxMax = genActivate();
-  for (int i = 0; i <= subStepIdxMax; i ++) {
-    fprintf(header, "void subStep%d();\n", i);
+  genColdSuper(header);
+  genLazySuper(header);
+  int subStepIdxMax = -1;
+  if (isThreaded()) {
+    std::vector<int> subStepNum;
+    genThreadActivate(subStepNum);
+    for (int t = 0; t < globalConfig.ThreadNum; t ++) {
+      for (int i = 0; i < subStepNum[t]; i ++) fprintf(header, "void threadStep%d_%d();\n", t, i);
+      fprintf(header, "void threadStep%d();\n", t);
+    }
+    fprintf(header, "void threadWorker(int tid);\n");
+    fprintf(header, "void startThreads();\n");
+    fprintf(header, "~S%s();\n", name.c_str());
+    genThreadStep(subStepNum);
+  } else {
+    subStepIdxMax = genActivate();
+    for (int i = 0; i <= subStepIdxMax; i ++) {
+      fprintf(header, "void subStep%d();\n", i);
+    }
   }
 
   /* step wrapper */
   fprintf(header, "void step();\n");
   genStep(subStepIdxMax);
+  genRun(header);
 
   /* end of file */
   fprintf(header, "};\n"
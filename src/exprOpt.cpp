@@ -1,6 +1,6 @@
 #include "common.h"
-#include <stack>
 #include <tuple>
+#include <map>
 
 void fillEmptyWhen(ExpTree* newTree, ENode* oldNode);
 
@@ -30,51 +30,305 @@ bool subTreeEq(ENode* enode1, ENode* enode2) {
   return true;
 }
 
-void ExpTree::treeOpt() {
-  std::stack<std::tuple<ENode*, ENode*, int>> s;
-  s.push(std::make_tuple(getRoot(), nullptr, -1));
-
-  while(!s.empty()) {
-    ENode* top, *parent;
-    int idx;
-    std::tie(top, parent, idx) = s.top();
-    s.pop();
-    if (top->opType == OP_WHEN || top->opType == OP_MUX) {
-      if (subTreeEq(top->getChild(1), top->getChild(2))) {
-        if (parent) {
-          parent->setChild(idx, top->getChild(1));
-        } else {
-          setRoot(top->getChild(1));
-        }
-        s.push(std::make_tuple(top->getChild(1), parent, idx));
-        continue;
-      }
-    }
-    if (top->opType == OP_ASASYNCRESET) {
-      if (parent) {
-        parent->setChild(idx, top->getChild(0));
-      } else {
-        setRoot(top->getChild(0));
-      }
-      s.push(std::make_tuple(top->getChild(0), parent, idx));
-      continue;
-    }
-    if (top->opType == OP_ASSINT || top->opType == OP_ASUINT) {
-      if (top->getChild(0)->sign == top->sign && top->getChild(0)->width == top->width) {
-        if (parent) {
-          parent->setChild(idx, top->getChild(0));
-        } else {
-          setRoot(top->getChild(0));
-        }
-        s.push(std::make_tuple(top->getChild(0), parent, idx));
-      }
-      continue;
-    }
-    /* width = 1 xor 0*/
-    for (size_t i = 0; i < top->child.size(); i ++) {
-      if (top->child[i]) s.push(std::make_tuple(top->child[i], top, i));
-    }
+/*
+  rule-based rewriting of expressions: every rule matches an enode of the given operations
+  whose children are already rewritten, and returns an equivalent enode of the same width
+  and sign (or nullptr). Rules only take operands whose semantics are unaffected by the
+  rewrite, mostly unsigned ones. A tree is rewritten until no rule fires.
+  Subexpressions are hash-consed into cons ids, so identical operands are found by comparing
+  ids; the enodes themselves are not shared, as later passes update them in place
+*/
+typedef std::tuple<int, int, bool, int, int, std::string, std::vector<int>, std::vector<int>> ExprKey;
+static std::map<ExprKey, int> consTable;
+static std::map<ENode*, int> consId;
+static int consNum = 0;
+
+static void consENode(ENode* enode) {
+  std::vector<int> childIds;
+  for (ENode* child : enode->child) {
+    if (child && consId.find(child) == consId.end()) consId[child] = consNum ++; // unknown enodes only equal themselves
+    childIds.push_back(child ? consId[child] : -1);
   }
+  ExprKey key = std::make_tuple(enode->opType, enode->width, enode->sign, enode->nodePtr ? enode->nodePtr->id : -1,
+                                enode->memoryNode ? enode->memoryNode->id : -1, enode->strVal, enode->values, childIds);
+  if (consTable.find(key) == consTable.end()) consTable[key] = consNum ++;
+  consId[enode] = consTable[key];
+}
+
+/* enodes created by a rule, the reused operands are already consed */
+static void consNewENode(ENode* enode) {
+  if (consId.find(enode) != consId.end()) return;
+  for (ENode* child : enode->child) {
+    if (child) consNewENode(child);
+  }
+  consENode(enode);
+}
+
+static bool sameExpr(ENode* enode1, ENode* enode2) {
+  if (!enode1 || !enode2 || consId.find(enode1) == consId.end() || consId.find(enode2) == consId.end()) return false;
+  return consId[enode1] == consId[enode2];
+}
+
+/* unsigned constants: pow2 = k if the value is 2^k, ones = k if the value is 2^k-1, otherwise -1 */
+static bool constInfo(ENode* enode, int& pow2, int& ones) {
+  if (enode->opType != OP_INT || enode->nodePtr || enode->sign) return false;
+  std::string str;
+  int base;
+  std::tie(base, str) = firStrBase(enode->strVal);
+  if (str.empty() || str[0] == '-') return false;
+  mpz_t val;
+  mpz_init(val);
+  bool ret = mpz_set_str(val, str.c_str(), base) == 0;
+  mpz_fdiv_r_2exp(val, val, enode->width);
+  pow2 = mpz_popcount(val) == 1 ? mpz_scan1(val, 0) : -1;
+  mpz_add_ui(val, val, 1);
+  ones = mpz_popcount(val) == 1 ? mpz_scan1(val, 0) : -1;
+  mpz_clear(val);
+  return ret;
+}
+
+static ENode* newENode(OPType op, std::vector<ENode*> child, int width, bool sign, std::vector<int> values = {}) {
+  ENode* ret = new ENode(op);
+  for (ENode* enode : child) ret->addChild(enode);
+  ret->setWidth(width, sign);
+  ret->values = values;
+  return ret;
+}
+
+static ENode* bitsENode(ENode* enode, int hi, int lo) {
+  if (lo == 0 && hi == enode->width - 1 && !enode->sign) return enode;
+  return newENode(OP_BITS, {enode}, hi - lo + 1, false, {hi, lo});
+}
+
+/* zero-extend an unsigned enode */
+static ENode* padENode(ENode* enode, int width) {
+  if (enode->width == width || enode->sign) return enode;
+  return newENode(OP_PAD, {enode}, width, false, {width});
+}
+
+static ENode* zeroENode(int width) { return allocIntEnode(width, "0"); }
+
+/* the operand of a binary operation whose other operand is an unsigned constant */
+static ENode* constOperand(ENode* enode, int& pow2, int& ones, bool commutative = true) {
+  if (enode->getChild(0)->sign || enode->getChild(1)->sign) return nullptr;
+  if (constInfo(enode->getChild(1), pow2, ones)) return enode->getChild(0);
+  if (commutative && constInfo(enode->getChild(0), pow2, ones)) return enode->getChild(1);
+  return nullptr;
+}
+
+static ENode* muxSameArms(ENode* enode) {
+  return sameExpr(enode->getChild(1), enode->getChild(2)) ? enode->getChild(1) : nullptr;
+}
+
+static ENode* castIdentity(ENode* enode) {
+  return enode->getChild(0);
+}
+
+static ENode* bitsOfCat(ENode* enode) {
+  ENode* cat = enode->getChild(0);
+  if (cat->opType != OP_CAT) return nullptr;
+  int hi = enode->values[0], lo = enode->values[1];
+  int lowWidth = cat->getChild(1)->width;
+  if (hi < lowWidth) return bitsENode(cat->getChild(1), hi, lo);
+  if (lo >= lowWidth && hi < cat->width) return bitsENode(cat->getChild(0), hi - lowWidth, lo - lowWidth);
+  return nullptr;
+}
+
+/* bits of bits, shr or pad, and bits covering the whole operand */
+static ENode* bitsFold(ENode* enode) {
+  ENode* child = enode->getChild(0);
+  int hi = enode->values[0], lo = enode->values[1];
+  if (hi >= child->width) return nullptr;
+  if (lo == 0 && hi == child->width - 1 && !child->sign) return child;
+  if (child->nodePtr) return nullptr;
+  ENode* operand = child->getChildNum() == 1 ? child->getChild(0) : nullptr;
+  switch (child->opType) {
+    case OP_BITS:
+      if (hi + child->values[1] < operand->width) return bitsENode(operand, hi + child->values[1], lo + child->values[1]);
+      break;
+    case OP_SHR:
+      if (hi + child->values[0] < operand->width) return bitsENode(operand, hi + child->values[0], lo + child->values[0]);
+      break;
+    case OP_PAD:
+      if (hi < operand->width) return bitsENode(operand, hi, lo);
+      break;
+    default:
+      break;
+  }
+  return nullptr;
+}
+
+static ENode* shiftOfShift(ENode* enode) {
+  ENode* child = enode->getChild(0);
+  if (child->opType != enode->opType || child->nodePtr || child->sign) return nullptr;
+  return newENode(enode->opType, {child->getChild(0)}, enode->width, false, {enode->values[0] + child->values[0]});
+}
+
+static ENode* andConst(ENode* enode) {
+  int pow2, ones;
+  ENode* operand = constOperand(enode, pow2, ones);
+  if (!operand || ones < 0) return nullptr;
+  if (ones == 0) return zeroENode(enode->width);
+  if (ones >= operand->width) return padENode(operand, enode->width);
+  return padENode(bitsENode(operand, ones - 1, 0), enode->width);
+}
+
+static ENode* orConst(ENode* enode) {
+  int pow2, ones;
+  ENode* operand = constOperand(enode, pow2, ones);
+  if (!operand) return nullptr;
+  if (ones == 0) return padENode(operand, enode->width);
+  if (ones == enode->width) return operand == enode->getChild(0) ? enode->getChild(1) : enode->getChild(0);
+  return nullptr;
+}
+
+static ENode* xorConst(ENode* enode) {
+  int pow2, ones;
+  ENode* operand = constOperand(enode, pow2, ones);
+  if (!operand) return nullptr;
+  if (ones == 0) return padENode(operand, enode->width);
+  if (ones == enode->width && operand->width == enode->width) return newENode(OP_NOT, {operand}, enode->width, false);
+  return nullptr;
+}
+
+/* x & x, x | x */
+static ENode* idempotent(ENode* enode) {
+  if (enode->getChild(0)->sign || !sameExpr(enode->getChild(0), enode->getChild(1))) return nullptr;
+  return enode->getChild(0);
+}
+
+static ENode* xorSelf(ENode* enode) {
+  if (enode->getChild(0)->sign || !sameExpr(enode->getChild(0), enode->getChild(1))) return nullptr;
+  return zeroENode(enode->width);
+}
+
+/* dshl(1, s) == 2^k -> s == k */
+static ENode* eqOneHot(ENode* enode) {
+  int pow2, ones;
+  ENode* oneHot = constOperand(enode, pow2, ones);
+  if (!oneHot || oneHot->opType != OP_DSHL || oneHot->nodePtr) return nullptr;
+  ENode* shift = oneHot->getChild(1);
+  int onePow2, oneOnes;
+  if (!constInfo(oneHot->getChild(0), onePow2, oneOnes) || oneOnes != 1 || shift->width >= 31) return nullptr;
+  if (pow2 < 0 || pow2 >= (1 << shift->width)) return allocIntEnode(1, enode->opType == OP_EQ ? "0" : "1");
+  return newENode(enode->opType, {shift, allocIntEnode(shift->width, std::to_string(pow2))}, 1, false);
+}
+
+/* comparison of a 1-bit operand with a constant */
+static ENode* eqBool(ENode* enode) {
+  int pow2, ones;
+  ENode* operand = constOperand(enode, pow2, ones);
+  if (!operand || operand->width != 1) return nullptr;
+  if (ones != 0 && ones != 1) return allocIntEnode(1, enode->opType == OP_EQ ? "0" : "1");
+  if ((ones == 1) == (enode->opType == OP_EQ)) return operand;
+  return newENode(OP_NOT, {operand}, 1, false);
+}
+
+static ENode* notNot(ENode* enode) {
+  ENode* child = enode->getChild(0);
+  if (child->opType != OP_NOT || child->nodePtr) return nullptr;
+  return child->getChild(0);
+}
+
+static ENode* padFold(ENode* enode) {
+  ENode* child = enode->getChild(0);
+  if (enode->values[0] <= child->width) return child;
+  if (child->opType == OP_PAD && !child->nodePtr) return newENode(OP_PAD, {child->getChild(0)}, enode->width, enode->sign, {enode->width});
+  return nullptr;
+}
+
+/* values[0] of tail is the number of remaining bits (see updateHeadTail) */
+static ENode* tailFold(ENode* enode) {
+  ENode* child = enode->getChild(0);
+  int remain = enode->values[0];
+  if (remain == child->width && !child->sign) return child;
+  if (child->nodePtr) return nullptr;
+  if (child->opType == OP_TAIL) return newENode(OP_TAIL, {child->getChild(0)}, enode->width, false, {remain});
+  if (child->opType == OP_PAD && !child->sign && remain >= child->getChild(0)->width) return padENode(child->getChild(0), remain);
+  return nullptr;
+}
+
+static ENode* mulPow2(ENode* enode) {
+  int pow2, ones;
+  ENode* operand = constOperand(enode, pow2, ones);
+  if (!operand) return nullptr;
+  if (ones == 0) return zeroENode(enode->width);
+  if (pow2 == 0) return padENode(operand, enode->width);
+  if (pow2 > 0) return padENode(newENode(OP_SHL, {operand}, operand->width + pow2, false, {pow2}), enode->width);
+  return nullptr;
+}
+
+static ENode* divPow2(ENode* enode) {
+  int pow2, ones;
+  ENode* operand = constOperand(enode, pow2, ones, false);
+  if (!operand || pow2 < 0) return nullptr;
+  if (pow2 == 0) return padENode(operand, enode->width);
+  if (pow2 >= operand->width) return zeroENode(enode->width);
+  return padENode(newENode(OP_SHR, {operand}, operand->width - pow2, false, {pow2}), enode->width);
+}
+
+static ENode* remPow2(ENode* enode) {
+  int pow2, ones;
+  ENode* operand = constOperand(enode, pow2, ones, false);
+  if (!operand || pow2 < 0) return nullptr;
+  if (pow2 == 0) return zeroENode(enode->width);
+  if (pow2 >= operand->width) return padENode(operand, enode->width);
+  return padENode(bitsENode(operand, pow2 - 1, 0), enode->width);
+}
+
+struct RewriteRule {
+  const char* name;
+  std::vector<OPType> ops;
+  ENode* (*apply)(ENode* enode);
+  size_t count;
+};
+
+static RewriteRule rewriteRules[] = {
+  {"mux-same-arms", {OP_MUX, OP_WHEN}, muxSameArms, 0},
+  {"cast-identity", {OP_ASUINT, OP_ASSINT, OP_ASASYNCRESET}, castIdentity, 0},
+  {"bits-of-cat", {OP_BITS}, bitsOfCat, 0},
+  {"bits-fold", {OP_BITS}, bitsFold, 0},
+  {"shift-of-shift", {OP_SHL, OP_SHR}, shiftOfShift, 0},
+  {"and-const", {OP_AND}, andConst, 0},
+  {"or-const", {OP_OR}, orConst, 0},
+  {"xor-const", {OP_XOR}, xorConst, 0},
+  {"idempotent", {OP_AND, OP_OR}, idempotent, 0},
+  {"xor-self", {OP_XOR}, xorSelf, 0},
+  {"eq-one-hot", {OP_EQ, OP_NEQ}, eqOneHot, 0},
+  {"eq-bool", {OP_EQ, OP_NEQ}, eqBool, 0},
+  {"not-not", {OP_NOT}, notNot, 0},
+  {"pad-fold", {OP_PAD}, padFold, 0},
+  {"tail-fold", {OP_TAIL}, tailFold, 0},
+  {"mul-pow2", {OP_MUL}, mulPow2, 0},
+  {"div-pow2", {OP_DIV}, divPow2, 0},
+  {"rem-pow2", {OP_REM}, remPow2, 0},
+};
+
+/* rewrite the children, then apply the first matching rule */
+static ENode* rewriteENode(ENode* enode, bool& changed) {
+  for (size_t i = 0; i < enode->getChildNum(); i ++) {
+    if (enode->getChild(i)) enode->setChild(i, rewriteENode(enode->getChild(i), changed));
+  }
+  consENode(enode);
+  if (enode->nodePtr || enode->width <= 0) return enode;
+  for (RewriteRule& rule : rewriteRules) {
+    if (std::find(rule.ops.begin(), rule.ops.end(), enode->opType) == rule.ops.end()) continue;
+    ENode* ret = rule.apply(enode);
+    if (!ret || ret->width != enode->width || ret->sign != enode->sign) continue;
+    consNewENode(ret);
+    rule.count ++;
+    changed = true;
+    return ret;
+  }
+  return enode;
+}
+
+void ExpTree::treeOpt() {
+  bool changed;
+  do {
+    changed = false;
+    setRoot(rewriteENode(getRoot(), changed));
+  } while (changed);
 }
 
 void graph::exprOpt() {
@@ -92,5 +346,12 @@ void graph::exprOpt() {
     }
   }
 
+  std::string stat;
+  for (RewriteRule& rule : rewriteRules) stat += format("%s%s %ld", stat.empty() ? "" : ", ", rule.name, rule.count);
+  printf("[exprOpt] %ld distinct subexpressions, rewrites: %s\n", consTable.size(), stat.c_str());
+  consTable.clear();
+  consId.clear();
+  consNum = 0;
+
   reconnectAll();
 }
@@ -3,9 +3,12 @@
 #include "Parser.h"
 #include <future>
 #include <mutex>
-#include <condition_variable>
+#include <deque>
+#include <chrono>
 
-#define MODULES_PER_TASK 5
+/* modules are grouped into tasks of at least MIN_TASK_BYTES, about TASKS_PER_JOB tasks for each thread */
+#define TASKS_PER_JOB 8
+#define MIN_TASK_BYTES (64 * 1024)
 
 typedef struct TaskRecord {
   off_t offset;
@@ -14,9 +17,25 @@ typedef struct TaskRecord {
   int id;
 } TaskRecord;
 
-static std::vector<TaskRecord> *taskQueue;
-static std::mutex m;
-static std::condition_variable cv;
+/*
+  work-stealing task queues: every thread takes the largest task from the front of its own
+  queue, and steals the smallest task from the back of another queue when its queue is empty
+*/
+typedef struct TaskQueue {
+  std::mutex lock;
+  std::deque<TaskRecord> tasks;
+  size_t bytes = 0;
+} TaskQueue;
+
+typedef struct ThreadStat {
+  int tasks = 0;
+  int steals = 0;
+  size_t bytes = 0;
+  double busyMs = 0;
+} ThreadStat;
+
+static std::vector<TaskQueue> *taskQueues;
+static std::vector<ThreadStat> *threadStats;
 static PList **lists;
 static PNode *globalRoot;
 
@@ -60,21 +79,34 @@ static char* findNextModuleMarker(char* start) {
   }
 }
 
+static bool fetchTask(int tid, TaskRecord& task) {
+  int jobs = taskQueues->size();
+  for (int i = 0; i < jobs; i ++) {
+    TaskQueue& queue = (*taskQueues)[(tid + i) % jobs];
+    std::lock_guard lk(queue.lock);
+    if (queue.tasks.empty()) continue;
+    if (i == 0) {
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+    } else {
+      task = queue.tasks.back();
+      queue.tasks.pop_back();
+      (*threadStats)[tid].steals ++;
+    }
+    return true;
+  }
+  return false; // no task is created after the threads start
+}
+
 void parseFunc(char *strbuf, int tid) {
-  while (true) {
-    std::unique_lock lk(m);
-    cv.wait(lk, []{ return !taskQueue->empty(); });
-    auto e = taskQueue->back();
-    taskQueue->pop_back();
-    lk.unlock();
-    cv.notify_one();
-
-    if (e.id == -1) { return; }
+  TaskRecord e;
+  ThreadStat& stat = (*threadStats)[tid];
+  while (fetchTask(tid, e)) {
+    auto start = std::chrono::steady_clock::now();
     //Log("e.offset = %ld, e.lineno = %d", e.offset, e.lineno);
     //for (int i = 0; i < 100; i ++) { putchar(strbuf[e.offset + i]); } putchar('\n');
 
-    std::istringstream *streamBuf = new std::istringstream(strbuf + e.offset);
-    Parser::Lexical *lexical = new Parser::Lexical(*streamBuf, std::cout);
+    Parser::Lexical *lexical = new Parser::Lexical(strbuf + e.offset, e.len);
     Parser::Syntax *syntax = new Parser::Syntax(lexical);
     lexical->set_lineno(e.lineno);
     syntax->parse();
@@ -87,16 +119,16 @@ void parseFunc(char *strbuf, int tid) {
 
     delete syntax;
     delete lexical;
-    delete streamBuf;
+    stat.tasks ++;
+    stat.bytes += e.len;
+    stat.busyMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
   }
 }
 
 PNode* parseFIR(char *strbuf) {
-  taskQueue = new std::vector<TaskRecord>;
-  std::future<void> *threads = new std::future<void> [NR_THREAD];
-
   // create tasks
   char *prev = strbuf;
+  char *end = strbuf + strlen(strbuf);
   int next_lineno = 1;
   int id = 0;
   int modules = 0;
@@ -109,51 +141,47 @@ PNode* parseFIR(char *strbuf) {
   }
   modules = moduleMarkers.size();
 
-  if (moduleMarkers.empty()) {
-    taskQueue->push_back(TaskRecord{prev - strbuf, strlen(prev) + 1, next_lineno, id});
-    id ++;
-  } else {
-    size_t idx = 0;
-    while (idx < moduleMarkers.size()) {
-      int prev_lineno = next_lineno;
-      size_t nextIdx = idx + MODULES_PER_TASK;
-      bool isEnd = nextIdx >= moduleMarkers.size();
-      char* split = nullptr;
-      if (!isEnd) {
-        split = moduleMarkers[nextIdx];
-        assert(split[0] == '\n');
-        split[0] = '\0';
-        for (char *q = prev; (q = strchr(q, '\n')) != NULL; next_lineno ++, q ++);
-        next_lineno ++; // '\0' is overwritten originally from '\n', so count it
-      }
-      taskQueue->push_back(TaskRecord{prev - strbuf, strlen(prev) + 1, prev_lineno, id});
-      id ++;
-      if (isEnd) break;
-      prev = split + 1;
-      idx = nextIdx;
-    }
+  /* tasks are [offset, offset + len) ranges of the buffer, split at module markers */
+  size_t taskBytes = MAX((size_t)(end - strbuf) / (globalConfig.ParserJobs * TASKS_PER_JOB), (size_t)MIN_TASK_BYTES);
+  std::vector<TaskRecord> tasks;
+  for (char* split : moduleMarkers) {
+    if ((size_t)(split - prev) < taskBytes) continue;
+    assert(split[0] == '\n');
+    tasks.push_back(TaskRecord{prev - strbuf, (size_t)(split - prev), next_lineno, id ++});
+    next_lineno += std::count(prev, split + 1, '\n');
+    prev = split + 1;
   }
+  tasks.push_back(TaskRecord{prev - strbuf, (size_t)(end - prev), next_lineno, id ++});
+
+  int jobs = MIN(globalConfig.ParserJobs, id);
   printf("[Parser] using %d threads to parse %d modules with %d tasks\n",
-      NR_THREAD, modules, id);
+      jobs, modules, id);
   lists = new PList* [id];
-  for (int i = 0; i < NR_THREAD; i ++) {
-    taskQueue->push_back(TaskRecord{0, 0, -1, -1}); // exit flags
-  }
 
-  // sort to handle the largest module first
-  std::sort(taskQueue->begin(), taskQueue->end(),
-      [](TaskRecord &a, TaskRecord &b){ return a.len < b.len; });
+  // handle the largest task first, and balance the bytes of all queues
+  std::sort(tasks.begin(), tasks.end(),
+      [](TaskRecord &a, TaskRecord &b){ return a.len > b.len; });
+  taskQueues = new std::vector<TaskQueue>(jobs);
+  threadStats = new std::vector<ThreadStat>(jobs);
+  for (TaskRecord& task : tasks) {
+    TaskQueue& queue = *std::min_element(taskQueues->begin(), taskQueues->end(),
+      [](TaskQueue &a, TaskQueue &b){ return a.bytes < b.bytes; });
+    queue.tasks.push_back(task);
+    queue.bytes += task.len;
+  }
 
   // create threads
-  for (int i = 0; i < NR_THREAD; i ++) {
+  std::future<void> *threads = new std::future<void> [jobs];
+  for (int i = 0; i < jobs; i ++) {
     threads[i] = async(std::launch::async, parseFunc, strbuf, i);
   }
 
-  for (int i = 0; i < NR_THREAD; i ++) {
-    printf("[Parser] waiting for thread %d/%d...\n", i, NR_THREAD - 1);
+  for (int i = 0; i < jobs; i ++) {
     threads[i].get();
+    ThreadStat& stat = (*threadStats)[i];
+    printf("[Parser] thread %d: %d tasks (%d stolen), %ld bytes, busy %.0lf ms\n",
+        i, stat.tasks, stat.steals, stat.bytes, stat.busyMs);
   }
-  assert(taskQueue->empty());
 
   printf("[Parser] merging lists...\n");
   TIMER_START(MergeList);
@@ -165,6 +193,7 @@ PNode* parseFIR(char *strbuf) {
 
   delete [] lists;
   delete [] threads;
-  delete taskQueue;
+  delete taskQueues;
+  delete threadStats;
   return globalRoot;
 }
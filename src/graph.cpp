@@ -59,6 +59,28 @@ size_t graph::countNodes() {
   return ret;
 }
 
+/* node, superNode and node edge counts, walking from supersrc before topoSort */
+void graph::countGraph(size_t& nodeNum, size_t& superNum, size_t& edgeNum) {
+  std::vector<SuperNode*> supers;
+  if (!sortedSuper.empty()) {
+    supers = sortedSuper;
+  } else {
+    std::set<SuperNode*> visited(supersrc.begin(), supersrc.end());
+    supers.assign(visited.begin(), visited.end());
+    for (size_t i = 0; i < supers.size(); i ++) {
+      for (SuperNode* next : supers[i]->next) {
+        if (visited.insert(next).second) supers.push_back(next);
+      }
+    }
+  }
+  nodeNum = edgeNum = 0;
+  superNum = supers.size();
+  for (SuperNode* super : supers) {
+    nodeNum += super->member.size();
+    for (Node* member : super->member) edgeNum += member->next.size();
+  }
+}
+
 void graph::removeNodes(NodeStatus status) {
   removeNodesNoConnect(status);
   removeEmptySuper();
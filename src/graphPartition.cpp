@@ -7,9 +7,13 @@
 #include <stack>
 #include <map>
 #include <tuple>
+#include <cfloat>
 
 // #define SUPER_BOUND 35
 
+#define ACT_SUPER_COST 4 // estimated cost of checking and clearing the active flag of an activated superNode
+#define ACT_EDGE_COST 1  // estimated cost of activating a superNode from another one
+
 void graph::resort() {
   std::map<SuperNode*, int>times;
   std::stack<SuperNode*> s;
@@ -70,42 +74,46 @@ void graph::graphInitPartition() {
     - T(x) = C(x) + T(y)
   * dynamic programming
   */
-  std::vector<int> T(sortedSuper.size() + 1, INT_MAX);
   std::vector<int> b(sortedSuper.size() + 1, -1); // backtrace
-  std::vector<int> C(sortedSuper.size() + 1, 0);
-  std::vector<int> internal(sortedSuper.size() + 1, 0);
-  /* compute C */
-  for (size_t idx = 0; idx < sortedSuper.size(); idx ++) {
-    for (SuperNode* next : sortedSuper[idx]->next) {
-      // printf("edge %d -> %d\n", sortedSuper[idx]->order, next->order);
-      for (int i = sortedSuper[idx]->order + 1; i <= next->order; i ++) {
-        C[i] ++;
+  if (hasActivityProfile()) {
+    activityPartition(b);
+  } else {
+    std::vector<int> T(sortedSuper.size() + 1, INT_MAX);
+    std::vector<int> C(sortedSuper.size() + 1, 0);
+    std::vector<int> internal(sortedSuper.size() + 1, 0);
+    /* compute C */
+    for (size_t idx = 0; idx < sortedSuper.size(); idx ++) {
+      for (SuperNode* next : sortedSuper[idx]->next) {
+        // printf("edge %d -> %d\n", sortedSuper[idx]->order, next->order);
+        for (int i = sortedSuper[idx]->order + 1; i <= next->order; i ++) {
+          C[i] ++;
+        }
+        internal[next->order] ++;
       }
-      internal[next->order] ++;
-    }
-  }
-  for (size_t i = 1; i < internal.size(); i ++) internal[i] += internal[i - 1];
-  // for (int i = 0; i < sortedSuper.size(); i ++) printf("C[%d] = %d internal[%d] = %d\n", i, C[i], i, internal[i]);
-  T[0] = 0;
-  /* compute T by dynamic programming */
-  for (size_t i = 0; i < sortedSuper.size(); i ++) {
-    // printf("T[%ld] = %d size %ld\n", i, T[i], sortedSuper[i]->member.size());
-    size_t nextBound = i + 1;
-    size_t accuCost = sortedSuper[i]->member.size();
-    for (; nextBound < sortedSuper.size() && accuCost + sortedSuper[nextBound]->member.size() <= globalConfig.SuperNodeMaxSize; nextBound ++) {
-      accuCost += sortedSuper[nextBound]->member.size();
     }
-    /* update T[i + 1] to T[nextBound] that jmp at i */
-    int Cij = 0;
-    for (size_t j = i + 1; j <= nextBound; j ++) {
-      Cij += sortedSuper[j - 1]->next.size();
-      for (SuperNode* prev : sortedSuper[j - 1]->prev) {
-        if (prev->order >= (int)i) Cij --;
+    for (size_t i = 1; i < internal.size(); i ++) internal[i] += internal[i - 1];
+    // for (int i = 0; i < sortedSuper.size(); i ++) printf("C[%d] = %d internal[%d] = %d\n", i, C[i], i, internal[i]);
+    T[0] = 0;
+    /* compute T by dynamic programming */
+    for (size_t i = 0; i < sortedSuper.size(); i ++) {
+      // printf("T[%ld] = %d size %ld\n", i, T[i], sortedSuper[i]->member.size());
+      size_t nextBound = i + 1;
+      size_t accuCost = sortedSuper[i]->member.size();
+      for (; nextBound < sortedSuper.size() && accuCost + sortedSuper[nextBound]->member.size() <= globalConfig.SuperNodeMaxSize; nextBound ++) {
+        accuCost += sortedSuper[nextBound]->member.size();
       }
-      int newT = T[i] + Cij;
-      if(T[j] > newT) {
-        T[j] = newT;
-        b[j] = i;
+      /* update T[i + 1] to T[nextBound] that jmp at i */
+      int Cij = 0;
+      for (size_t j = i + 1; j <= nextBound; j ++) {
+        Cij += sortedSuper[j - 1]->next.size();
+        for (SuperNode* prev : sortedSuper[j - 1]->prev) {
+          if (prev->order >= (int)i) Cij --;
+        }
+        int newT = T[i] + Cij;
+        if(T[j] > newT) {
+          T[j] = newT;
+          b[j] = i;
+        }
       }
     }
   }
@@ -141,6 +149,47 @@ void graph::graphInitPartition() {
   reconnectSuper();
 }
 
+/*
+  partition with the activity profile: minimize the expected work per cycle instead of the edge cut
+  a superNode [i, j) is activated when any of its entry members (with predecessors before i) is activated,
+  assuming they are activated independently, and all its members are evaluated then.
+  members activated by other members cost no extra activation, rarely activated nodes are kept
+  away from hot ones
+*/
+void graph::activityPartition(std::vector<int>& b) {
+  size_t num = sortedSuper.size();
+  std::vector<double> T(num + 1, DBL_MAX);
+  std::map<Node*, NodeActivity> activity;
+  for (SuperNode* super : sortedSuper) {
+    for (Node* member : super->member) activity[member] = nodeActivity(member);
+  }
+  T[0] = 0;
+  for (size_t i = 0; i < num; i ++) {
+    size_t size = 0;
+    double idleProb = 1;  // probability that no entry member is activated
+    double incoming = 0;  // expected activations from superNodes before i
+    for (size_t j = i + 1; j <= num; j ++) {
+      SuperNode* super = sortedSuper[j - 1];
+      if (j > i + 1 && size + super->member.size() > (size_t)globalConfig.SuperNodeMaxSize) break;
+      size += super->member.size();
+      for (Node* member : super->member) {
+        bool isEntry = member->prev.empty();
+        for (Node* prev : member->prev) {
+          if (prev->super->order >= (int)i) continue;
+          isEntry = true;
+          incoming += activity[prev].changeRate;
+        }
+        if (isEntry) idleProb *= 1 - activity[member].activeRate;
+      }
+      double newT = T[i] + (size + ACT_SUPER_COST) * (1 - idleProb) + incoming * ACT_EDGE_COST;
+      if (T[j] > newT) {
+        T[j] = newT;
+        b[j] = i;
+      }
+    }
+  }
+  printf("[graphPartition] activity profile: estimated cost %.2lf per cycle\n", T[num]);
+}
 
 #define REFINE_TYPE std::tuple<Node*, SuperNode*, int>
 #define REFINE_NODE(gain) std::get<0>(gain)
@@ -3,6 +3,7 @@
   merge constantNode into here
 */
 
+#include <cstring>
 #include <map>
 #include <gmp.h>
 #include <queue>
@@ -30,14 +31,9 @@ std::string idx2Str(Node* node, int idx, int dim);
 
 int maxConcatNum = 0;
 
+/* val > 2^width - 1, compared without building the mask */
 static bool mpzOutOfBound(mpz_t& val, int width) {
-  mpz_t tmp;
-  mpz_init(tmp);
-  mpz_set_ui(tmp, 1);
-  mpz_mul_2exp(tmp, tmp, width);
-  mpz_sub_ui(tmp, tmp, 1);
-  if (mpz_cmp(val, tmp) > 0) return true;
-  return false;
+  return mpz_sgn(val) > 0 && mpz_sizeinbase(val, 2) > (size_t)width;
 }
 
 std::string legalCppCons(std::string str) {
@@ -57,17 +53,27 @@ static std::string addBracket(std::string str) {
   return "(" + str + ")";
 }
 
+std::string mpzHexStr(mpz_t& val) {
+  if (mpz_sgn(val) >= 0 && mpz_sizeinbase(val, 2) <= 64) {
+    char buf[20];
+    snprintf(buf, sizeof(buf), "%lx", mpz_get_ui(val));
+    return buf;
+  }
+  char* str = mpz_get_str(NULL, 16, val);
+  std::string ret(str);
+  void (*freeFunc)(void*, size_t);
+  mp_get_memory_functions(NULL, NULL, &freeFunc);
+  freeFunc(str, strlen(str) + 1);
+  return ret;
+}
+
 static std::string getConsStr(mpz_t& val) {
-  std::string str = mpz_get_str(NULL, 16, val);
-  return legalCppCons(str);
+  return legalCppCons(mpzHexStr(val));
 }
+/* val == 2^width - 1 */
 bool allOnes(mpz_t& val, int width) {
-  mpz_t tmp;
-  mpz_init(tmp);
-  mpz_set_ui(tmp, 1);
-  mpz_mul_2exp(tmp, tmp, width);
-  mpz_sub_ui(tmp, tmp, 1);
-  return mpz_cmp(val, tmp) == 0;
+  if (width == 0) return mpz_sgn(val) == 0;
+  return mpz_sgn(val) > 0 && mpz_sizeinbase(val, 2) == (size_t)width && mpz_popcount(val) == (mp_bitcnt_t)width;
 }
 /* return: 0 - same size, positive - the first is larger, negative - the second is larger  */
 static int typeCmp(int width1, int width2) {
@@ -83,6 +89,11 @@ static std::string upperCast(int width1, int width2, bool sign) {
   return "";
 }
 
+/* --wide-kernels: unsigned results wider than 64 bits are computed word by word instead of by the _BitInt operators */
+static bool wideKernel(int width, bool sign) {
+  return globalConfig.WideKernels && !sign && width > 64;
+}
+
 static std::string rangeMask(int hi, int lo) {
   return "(" + bitMask(hi +1) +
           shiftBits(lo, ShiftDir::Right) +
@@ -761,7 +772,8 @@ valInfo* ENode::instsAnd(Node* node, std::string lvalue, bool isRoot) {
   } else {
     std::string lhs = upperCast(width, ChildInfo(0, width), Child(0, sign)) + ChildInfo(0, valStr);
     std::string rhs = upperCast(width, ChildInfo(1, width), Child(1, sign)) + ChildInfo(1, valStr);
-    ret->valStr = "(" + lhs + " & " + rhs + ")";
+    if (wideKernel(width, sign)) ret->valStr = format("gsim_and<%s>(%s, %s)", widthUType(width).c_str(), lhs.c_str(), rhs.c_str());
+    else ret->valStr = "(" + lhs + " & " + rhs + ")";
     ret->opNum = ChildInfo(0, opNum) + ChildInfo(1, opNum) + 1;
   }
   if (ChildInfo(0, typeWidth) > BASIC_WIDTH || ChildInfo(1, typeWidth) > BASIC_WIDTH) {
@@ -788,7 +800,8 @@ valInfo* ENode::instsOr(Node* node, std::string lvalue, bool isRoot) {
   } else {
     std::string lhs = upperCast(width, ChildInfo(0, width), Child(0, sign)) + ChildInfo(0, valStr);
     std::string rhs = upperCast(width, ChildInfo(1, width), Child(1, sign)) + ChildInfo(1, valStr);
-    ret->valStr = "(" + lhs + " | " + rhs + ")";
+    if (wideKernel(width, sign)) ret->valStr = format("gsim_or<%s>(%s, %s)", widthUType(width).c_str(), lhs.c_str(), rhs.c_str());
+    else ret->valStr = "(" + lhs + " | " + rhs + ")";
     ret->opNum = ChildInfo(0, opNum) + ChildInfo(1, opNum) + 1;
   }
   if (ChildInfo(0, typeWidth) > BASIC_WIDTH || ChildInfo(1, typeWidth) > BASIC_WIDTH) {
@@ -809,7 +822,8 @@ valInfo* ENode::instsXor(Node* node, std::string lvalue, bool isRoot) {
   } else {
     std::string lhs = upperCast(width, ChildInfo(0, width), Child(0, sign)) + ChildInfo(0, valStr);
     std::string rhs = upperCast(width, ChildInfo(1, width), Child(1, sign)) + ChildInfo(1, valStr);
-    ret->valStr = "(" + lhs + " ^ " + rhs + ")";
+    if (wideKernel(width, sign)) ret->valStr = format("gsim_xor<%s>(%s, %s)", widthUType(width).c_str(), lhs.c_str(), rhs.c_str());
+    else ret->valStr = "(" + lhs + " ^ " + rhs + ")";
     ret->opNum = ChildInfo(0, opNum) + ChildInfo(1, opNum) + 1;
   }
   if (ChildInfo(0, typeWidth) > BASIC_WIDTH || ChildInfo(1, typeWidth) > BASIC_WIDTH) {
@@ -857,6 +871,9 @@ valInfo* ENode::instsCat(Node* node, std::string lvalue, bool isRoot) {
     } else {
       if (ChildInfo(1, status) == VAL_CONSTANT && mpz_sgn(ChildInfo(1, consVal)) == 0) {
         ret->valStr = hi;
+      } else if (wideKernel(width, sign) && ChildInfo(0, status) != VAL_CONSTANT) {
+        ret->valStr = format("gsim_cat<%s>(%s%s, %s%s, %d)", widthUType(width).c_str(), upperCast(width, ChildInfo(0, width), false).c_str(),
+                             ChildInfo(0, valStr).c_str(), Cast(Child(1, width), false).c_str(), ChildInfo(1, valStr).c_str(), Child(1, width));
       } else {
         ret->valStr = format("(%s | %s%s)", hi.c_str(), Cast(Child(1, width), false).c_str(), ChildInfo(1, valStr).c_str());
       }
@@ -986,7 +1003,8 @@ valInfo* ENode::instsNot(Node* node, std::string lvalue, bool isRoot) {
     u_not(ret->consVal, ChildInfo(0, consVal), ChildInfo(0, width));
     ret->setConsStr();
   } else {
-    ret->valStr = "(" + ChildInfo(0, valStr) + " ^ " + bitMask(width) + ")";
+    if (wideKernel(width, sign)) ret->valStr = format("gsim_not<%s>(%s, %d)", widthUType(width).c_str(), ChildInfo(0, valStr).c_str(), width);
+    else ret->valStr = "(" + ChildInfo(0, valStr) + " ^ " + bitMask(width) + ")";
     ret->opNum = ChildInfo(0, opNum) + 1;
   }
   return ret;
@@ -1089,7 +1107,8 @@ valInfo* ENode::instsShl(Node* node, std::string lvalue, bool isRoot) {
     u_shl(ret->consVal, ChildInfo(0, consVal), ChildInfo(0, width), n);
     ret->setConsStr();
   } else {
-    ret->valStr = "(" + upperCast(width, ChildInfo(0, width), sign) + ChildInfo(0, valStr) + shiftBits(n, ShiftDir::Left)+ ")";
+    if (wideKernel(width, sign) && n != 0) ret->valStr = format("gsim_shl<%s>(%s, %d)", widthUType(width).c_str(), ChildInfo(0, valStr).c_str(), n);
+    else ret->valStr = "(" + upperCast(width, ChildInfo(0, width), sign) + ChildInfo(0, valStr) + shiftBits(n, ShiftDir::Left)+ ")";
     ret->opNum = ChildInfo(0, opNum) + 1;
   }
   return ret;
@@ -1105,7 +1124,8 @@ valInfo* ENode::instsShr(Node* node, std::string lvalue, bool isRoot) {
     (sign ? s_shr : u_shr)(ret->consVal, ChildInfo(0, consVal), ChildInfo(0, width), values[0]);  // n(values[0]) == width
     ret->setConsStr();
   } else {
-    ret->valStr = "(" + ChildInfo(0, valStr) + shiftBits(n, ShiftDir::Right) + ")";
+    if (wideKernel(ChildInfo(0, width), sign) && n != 0) ret->valStr = format("gsim_shr<%s>(%s, %d)", widthUType(ChildInfo(0, width)).c_str(), ChildInfo(0, valStr).c_str(), n);
+    else ret->valStr = "(" + ChildInfo(0, valStr) + shiftBits(n, ShiftDir::Right) + ")";
     ret->opNum = ChildInfo(0, opNum) + 1;
   }
   if (ChildInfo(0, typeWidth) > BASIC_WIDTH) {
@@ -1164,6 +1184,20 @@ valInfo* ENode::instsTail(Node* node, std::string lvalue, bool isRoot) {
   return ret;
 }
 
+/* a variable (or an element of it), whose words can be read in place */
+static bool isAddressable(std::string& str) {
+  size_t idx = 0;
+  while (idx < str.length() && (isalnum(str[idx]) || str[idx] == '_' || str[idx] == '$')) idx ++;
+  if (idx == 0 || isdigit(str[0])) return false;
+  while (idx < str.length()) {
+    if (str[idx ++] != '[') return false;
+    size_t start = idx;
+    while (idx < str.length() && (isalnum(str[idx]) || str[idx] == '_')) idx ++;
+    if (idx == start || idx == str.length() || str[idx ++] != ']') return false;
+  }
+  return true;
+}
+
 void infoBits(valInfo* ret, ENode* enode, valInfo* childInfo) {
   bool isConstant = childInfo->status == VAL_CONSTANT;
 
@@ -1180,6 +1214,11 @@ void infoBits(valInfo* ret, ENode* enode, valInfo* childInfo) {
   } else if (childInfo->width <= BASIC_WIDTH && lo == 0 && w == childInfo->width) {
     ret->valStr = childInfo->width;
     ret->opNum = childInfo->width;
+  } else if (globalConfig.WideKernels && !childInfo->sign && childInfo->width > 64 && (w <= 64 || (w <= 128 && lo != 0)) && hi < childInfo->width &&
+             isAddressable(childInfo->valStr)) {
+    /* read the words holding the field instead of shifting the whole _BitInt */
+    ret->valStr = format("gsim_bits%d(&%s, %d, %d)", w <= 64 ? 64 : 128, childInfo->valStr.c_str(), lo, w);
+    ret->opNum = childInfo->opNum + 1;
   } else {
     std::string shift;
     if (lo == 0) {
@@ -1373,7 +1412,7 @@ valInfo* ENode::instsPrintf() {
 valInfo* ENode::instsExit() {
   valInfo* ret = computeInfo;
   ret->status = VAL_FINISH;
-  std::string exitInst = format("if %s { exit(%s); }", addBracket(ChildInfo(0, valStr)).c_str(), strVal.c_str());
+  std::string exitInst = format("if %s { gExit(%s); }", addBracket(ChildInfo(0, valStr)).c_str(), strVal.c_str());
   ret->valStr = exitInst;
   ret->opNum = -1;
   return ret;
@@ -1387,17 +1426,17 @@ valInfo* ENode::instsAssert() {
   std::string assertInst;
   if (ChildInfo(0, status) == VAL_CONSTANT) { // pred is constant
     if (mpz_cmp_ui(ChildInfo(0, consVal), 0) == 0) {
-      assertInst = "gAssert(!" + enStr + ", " + strVal + ");";
+      assertInst = "gStopAssert(!" + enStr + ", " + strVal + ");";
     } else { // pred is always satisfied
       assertInst = "";
     }
   } else if (ChildInfo(1, status) == VAL_CONSTANT) { // en is constant pred is not constant
     if (mpz_cmp_ui(ChildInfo(1, consVal), 0) == 0) assertInst = "";
     else {
-      assertInst = "gAssert(" + predStr + ", " + strVal + ");";
+      assertInst = "gStopAssert(" + predStr + ", " + strVal + ");";
     }
   } else {
-    assertInst = "gAssert(!" + enStr + " || " + predStr + ", " + strVal + ");";
+    assertInst = "gStopAssert(!" + enStr + " || " + predStr + ", " + strVal + ");";
   }
   
   ret->valStr = assertInst;
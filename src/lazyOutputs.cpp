@@ -0,0 +1,67 @@
+/*
+  lazyOutputs: move the logic computing nothing but top-level outputs out of the superNodes,
+  so that the emitter evaluates it in the getters of the outputs instead of step()
+  a cone is the set of members whose consumers are all in the cone, and it is placed in a new
+  superNode right after the original one
+*/
+
+#include "common.h"
+
+/* nodes which may be evaluated on demand after step() */
+bool lazyOutputMember(Node* member) {
+  if (member->status != VALID_NODE) return false;
+  if ((member->type != NODE_OTHERS && member->type != NODE_OUT) || member->isArray() || member->isReset()) return false;
+  for (std::string watchName : globalConfig.WatchOutputs) {
+    if (member->name == watchName) return false;
+  }
+  for (Node* prev : member->prev) {
+    /* a getter between set_*() and step() must not see the new inputs */
+    if (prev->type == NODE_INP) return false;
+    /* the register is overwritten by its next value later in step() */
+    if (prev->type == NODE_REG_SRC && !prev->regSplit) return false;
+  }
+  return true;
+}
+
+void graph::splitOutputCones() {
+  std::vector<SuperNode*> newSorted;
+  size_t coneNum = 0, coneNodes = 0;
+  for (SuperNode* super : sortedSuper) {
+    newSorted.push_back(super);
+    if (super->superType != SUPER_VALID) continue;
+    std::set<Node*> cone;
+    for (bool changed = true; changed; ) {
+      changed = false;
+      for (Node* member : super->member) {
+        if (cone.find(member) != cone.end() || !lazyOutputMember(member)) continue;
+        bool inCone = true;
+        for (Node* next : member->next) {
+          if (cone.find(next) == cone.end()) inCone = false;
+        }
+        if (!inCone) continue;
+        cone.insert(member);
+        changed = true;
+      }
+    }
+    bool anyOutput = false;
+    size_t validNum = 0;
+    for (Node* member : super->member) {
+      if (member->status == VALID_NODE) validNum ++;
+      if (cone.find(member) != cone.end() && member->type == NODE_OUT) anyOutput = true;
+    }
+    if (!anyOutput || cone.size() == validNum) continue;
+    SuperNode* coneSuper = new SuperNode();
+    std::vector<Node*> remain;
+    for (Node* member : super->member) {
+      if (cone.find(member) != cone.end()) coneSuper->add_member(member);
+      else remain.push_back(member);
+    }
+    super->member = remain;
+    newSorted.push_back(coneSuper);
+    coneNum ++;
+    coneNodes += cone.size();
+  }
+  sortedSuper = newSorted;
+  reconnectSuper();
+  printf("[lazyOutputs] split %ld output cones (%ld nodes) from their superNodes\n", coneNum, coneNodes);
+}
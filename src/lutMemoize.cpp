@@ -0,0 +1,203 @@
+/*
+  lutMemoize: replace small pure logic cones (decoders, priority selects, next-state logic of
+  small FSMs) by table lookups
+  splitLutCones moves such a cone out of its superNode before the insts are generated: the
+  members are combinational nodes of at most 64 bits, and the nodes they read from outside the
+  cone (other superNodes, registers and inputs) have at most LutMaxBits bits in total.
+  lutMemoize then evaluates every qualifying superNode over its whole input space by the constant
+  analysis, and replaces its insts by a static const table per output indexed by the inputs
+*/
+
+#include "common.h"
+
+#define LUT_MIN_OPS 8             // smaller cones are cheaper to compute than to look up
+#define LUT_MAX_BYTES (64 * 1024) // tables of a superNode
+
+bool tabulateSuper(SuperNode* super, std::vector<Node*>& inputs, std::vector<Node*>& outputs, std::vector<std::vector<uint64_t>>& table);
+
+static int opCount(ENode* enode) {
+  if (!enode) return 0;
+  int num = (enode->nodePtr || enode->opType == OP_INT) ? 0 : 1;
+  for (ENode* child : enode->child) num += opCount(child);
+  return num;
+}
+
+static bool lutMember(Node* member) {
+  if (member->status != VALID_NODE || (member->type != NODE_OTHERS && member->type != NODE_OUT)) return false;
+  return !member->isArray() && !member->isReset() && member->width <= 64 && member->assignTree.size() == 1;
+}
+
+static bool lutInput(Node* node) {
+  if (node->status != VALID_NODE || node->isArray() || node->sign || node->width <= 0 || node->width > 64) return false;
+  if (node->type == NODE_REG_SRC) return node->regSplit; // an unsplit register is updated in place
+  return node->type == NODE_INP || node->type == NODE_OTHERS || node->type == NODE_OUT;
+}
+
+/* members read outside the cone keep their values, the others are no longer computed */
+static bool lutOutputs(std::vector<Node*>& members, int bits, std::vector<Node*>& outputs) {
+  std::set<Node*> cone(members.begin(), members.end());
+  size_t bytes = 0;
+  for (Node* member : members) {
+    bool isOutput = member->type == NODE_OUT;
+    for (Node* next : member->next) isOutput |= cone.find(next) == cone.end();
+    if (!isOutput) continue;
+    if (member->sign) return false;
+    outputs.push_back(member);
+    bytes += ((size_t)1 << bits) * (widthBits(member->width) / 8);
+  }
+  return !outputs.empty() && bytes <= LUT_MAX_BYTES;
+}
+
+static bool lutCandidate(SuperNode* super, std::vector<Node*>& inputs, std::vector<Node*>& outputs) {
+  if (super->superType != SUPER_VALID || super->member.empty()) return false;
+  int ops = 0;
+  for (Node* member : super->member) {
+    if (!lutMember(member)) return false;
+    ops += opCount(member->assignTree[0]->getRoot());
+  }
+  if (ops < LUT_MIN_OPS) return false;
+  std::set<Node*> inputSet;
+  int bits = 0;
+  for (Node* member : super->member) {
+    for (Node* prev : member->prev) {
+      if (prev->super == super || inputSet.find(prev) != inputSet.end()) continue;
+      if (!lutInput(prev)) return false;
+      inputSet.insert(prev);
+      bits += prev->width;
+      if (bits > globalConfig.LutMaxBits) return false;
+    }
+  }
+  inputs.assign(inputSet.begin(), inputSet.end());
+  std::sort(inputs.begin(), inputs.end(), [](Node* a, Node* b) { return a->id < b->id; });
+  return lutOutputs(super->member, bits, outputs);
+}
+
+/* registers and inputs which may be moved before the cones reading them */
+static bool lutHead(Node* node) {
+  if (node->type != NODE_REG_SRC && node->type != NODE_INP) return false;
+  for (Node* prev : node->prev) {
+    if (prev->super == node->super) return false;
+  }
+  return true;
+}
+
+/*
+  a cone grows in member order: a member joins if it reads only the cone, other superNodes,
+  and registers or inputs, within the input bits. The registers of a superNode are updated at
+  its beginning, so the ones read by the cones move to a new superNode followed by the cones,
+  all placed right before the original one
+*/
+void graph::splitLutCones() {
+  std::vector<SuperNode*> newSorted;
+  size_t coneNum = 0, coneNodes = 0;
+  for (SuperNode* super : sortedSuper) {
+    if (super->superType != SUPER_VALID) {
+      newSorted.push_back(super);
+      continue;
+    }
+    std::vector<SuperNode*> coneSupers;
+    std::set<Node*> heads;
+    while (true) {
+      std::vector<Node*> cone;
+      std::set<Node*> coneSet, inputs;
+      int bits = 0, ops = 0;
+      for (Node* member : super->member) {
+        if (!lutMember(member)) continue;
+        std::set<Node*> newInputs;
+        int newBits = bits;
+        bool valid = true;
+        for (Node* prev : member->prev) {
+          if (coneSet.find(prev) != coneSet.end() || inputs.find(prev) != inputs.end() || newInputs.find(prev) != newInputs.end()) continue;
+          if (!lutInput(prev) || (prev->super == super && !lutHead(prev))) valid = false;
+          newInputs.insert(prev);
+          newBits += prev->width;
+        }
+        if (!valid || newBits > globalConfig.LutMaxBits) continue;
+        cone.push_back(member);
+        coneSet.insert(member);
+        inputs.insert(newInputs.begin(), newInputs.end());
+        bits = newBits;
+        ops += opCount(member->assignTree[0]->getRoot());
+      }
+      std::vector<Node*> outputs;
+      if (ops < LUT_MIN_OPS || !lutOutputs(cone, bits, outputs)) break;
+      std::vector<Node*> remain;
+      for (Node* member : super->member) {
+        if (coneSet.find(member) == coneSet.end()) remain.push_back(member);
+      }
+      if (remain.empty() && coneSupers.empty()) break; // the whole superNode is tabulated
+      for (Node* input : inputs) {
+        if (input->super == super) heads.insert(input);
+      }
+      SuperNode* coneSuper = new SuperNode();
+      for (Node* member : cone) coneSuper->add_member(member);
+      super->member = remain;
+      coneSupers.push_back(coneSuper);
+      coneNum ++;
+      coneNodes += cone.size();
+    }
+    if (!heads.empty()) {
+      SuperNode* headSuper = new SuperNode();
+      std::vector<Node*> remain;
+      for (Node* member : super->member) {
+        if (heads.find(member) != heads.end()) headSuper->add_member(member);
+        else remain.push_back(member);
+      }
+      super->member = remain;
+      newSorted.push_back(headSuper);
+    }
+    newSorted.insert(newSorted.end(), coneSupers.begin(), coneSupers.end());
+    if (!super->member.empty()) newSorted.push_back(super);
+  }
+  sortedSuper = newSorted;
+  reconnectSuper();
+  printf("[lutMemoize] split %ld cones (%ld nodes) from their superNodes\n", coneNum, coneNodes);
+}
+
+static std::string tableDef(std::string name, Node* node, std::vector<uint64_t>& table) {
+  std::string ret = format("static const %s %s[%ld] = {", widthUType(node->width).c_str(), name.c_str(), table.size());
+  for (size_t i = 0; i < table.size(); i ++) {
+    ret += format("%s0x%lx%s", i % 16 == 0 ? "\n  " : "", table[i], i == table.size() - 1 ? "" : ", ");
+  }
+  return ret + "};";
+}
+
+void graph::lutMemoize() {
+  size_t lutNum = 0, lutNodes = 0, lutBytes = 0;
+  for (SuperNode* super : sortedSuper) {
+    std::vector<Node*> inputs, outputs;
+    std::vector<std::vector<uint64_t>> table;
+    if (!lutCandidate(super, inputs, outputs) || !tabulateSuper(super, inputs, outputs, table)) continue;
+    std::string idxName = format("lutIdx%d", super->id);
+    std::string idxStr;
+    int shift = 0;
+    for (Node* input : inputs) {
+      std::string val = input->width == widthBits(input->width) ? input->name : format("(%s & 0x%lx)", input->name.c_str(), BITMASK(input->width));
+      idxStr += format("%s(uint32_t)%s", idxStr.empty() ? "" : " | ", shift == 0 ? val.c_str() : format("(%s << %d)", val.c_str(), shift).c_str());
+      shift += input->width;
+    }
+    super->insts.clear();
+    super->insts.emplace_back("{", SUPER_INFO_IF);
+    std::vector<size_t> tableIdx(outputs.size()); // outputs with the same values share a table
+    for (size_t i = 0; i < outputs.size(); i ++) {
+      tableIdx[i] = i;
+      for (size_t j = 0; j < i; j ++) {
+        if (table[j] == table[i] && widthBits(outputs[j]->width) == widthBits(outputs[i]->width)) tableIdx[i] = tableIdx[j];
+      }
+      if (tableIdx[i] != i) continue;
+      super->insts.emplace_back(tableDef(format("lut%d_%ld", super->id, i), outputs[i], table[i]));
+      lutBytes += table[i].size() * (widthBits(outputs[i]->width) / 8);
+    }
+    super->insts.emplace_back(format("uint32_t %s = %s;", idxName.c_str(), idxStr.empty() ? "0" : idxStr.c_str()));
+    for (size_t i = 0; i < outputs.size(); i ++) {
+      super->insts.emplace_back(SUPER_INFO_ASSIGN_BEG, outputs[i]);
+      super->insts.emplace_back(format("%s = lut%d_%ld[%s];", outputs[i]->name.c_str(), super->id, tableIdx[i], idxName.c_str()));
+      super->insts.emplace_back(SUPER_INFO_ASSIGN_END, outputs[i]);
+    }
+    super->insts.emplace_back("}", SUPER_INFO_DEDENT);
+    lutNum ++;
+    lutNodes += super->member.size();
+    super->member = outputs;
+  }
+  printf("[lutMemoize] %ld superNodes (%ld nodes) are replaced by lookup tables (%ld bytes)\n", lutNum, lutNodes, lutBytes);
+}
@@ -12,6 +12,7 @@
 #include <getopt.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -46,6 +47,22 @@ Config::Config() {
   MergeWhenSize = 5;
   When2muxBound = 2;
   LogLevel = 0;
+  ThreadNum = 1;
+  ActiveWidth = 8;
+  Lanes = 1;
+  ParserJobs = sysconf(_SC_NPROCESSORS_ONLN);
+  if (ParserJobs < 1) ParserJobs = 1;
+  InstrumentActivity = false;
+  AlwaysActiveRatio = -1;
+  ColdRatio = -1;
+  ActiveLocality = false;
+  StateLayout = false;
+  SparseMemoryKB = -1;
+  WideKernels = false;
+  SkipIdle = false;
+  LazyOutputs = false;
+  LutMaxBits = 0;
+  PackBits = false;
 }
 Config globalConfig;
 
@@ -63,6 +80,124 @@ static inline bool shouldDumpStage(const std::string& name) {
   return globalConfig.DumpStages.empty() || globalConfig.DumpStages.count(name);
 }
 
+/* per-pass statistics for --stats-json */
+struct PassSample {
+  struct timeval wall;
+  uint64_t cpuUs = 0;
+  long rssKB = -1;
+  size_t nodeNum = 0, superNum = 0, edgeNum = 0;
+};
+
+struct PassStat {
+  std::string name;
+  std::string label;
+  PassSample before, after;
+  long peakKB;
+};
+
+static std::vector<PassStat> passStats;
+
+/* field of /proc/self/status in KB, -1 if unavailable */
+static long procStatusKB(const char* key) {
+  FILE* fp = fopen("/proc/self/status", "r");
+  if (!fp) return -1;
+  char line[256];
+  long ret = -1;
+  size_t len = strlen(key);
+  while (fgets(line, sizeof(line), fp)) {
+    if (strncmp(line, key, len) == 0 && line[len] == ':') {
+      sscanf(line + len + 1, "%ld", &ret);
+      break;
+    }
+  }
+  fclose(fp);
+  return ret;
+}
+
+static uint64_t cpuTimeUs() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000UL + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static PassSample samplePass(graph* g) {
+  PassSample sample;
+  if (g) g->countGraph(sample.nodeNum, sample.superNum, sample.edgeNum);
+  sample.rssKB = procStatusKB("VmRSS");
+  sample.cpuUs = cpuTimeUs();
+  sample.wall = getTime();
+  return sample;
+}
+
+static PassSample beginPassStats(graph* g) {
+  PassSample sample = samplePass(g);
+  /* reset VmHWM so that it holds the peak of this pass, it keeps the process peak if the kernel refuses */
+  FILE* fp = fopen("/proc/self/clear_refs", "w");
+  if (fp) {
+    fputs("5", fp);
+    fclose(fp);
+  }
+  sample.cpuUs = cpuTimeUs();
+  sample.wall = getTime();
+  return sample;
+}
+
+/* the called function in the wrapped statement, e.g. splitArray for g->splitArray() */
+static std::string passName(const char* func) {
+  const char* end = strchr(func, '(');
+  if (!end) return func;
+  const char* begin = end;
+  while (begin > func && (isalnum(begin[-1]) || begin[-1] == '_')) begin --;
+  return std::string(begin, end);
+}
+
+static void endPassStats(const char* func, const char* label, PassSample& before, graph* g) {
+  PassStat stat;
+  stat.name = passName(func);
+  stat.label = label;
+  stat.before = before;
+  stat.peakKB = procStatusKB("VmHWM");
+  stat.after = samplePass(g);
+  passStats.push_back(stat);
+}
+
+static std::string statsName(const std::string& name) {
+  std::string ret;
+  for (char c : name) {
+    if (c == '"' || c == '\\') ret += '\\';
+    ret += c;
+  }
+  return ret;
+}
+
+static void writeStatsJson(const char* input, struct timeval& start) {
+  FILE* fp = fopen(globalConfig.StatsJson.c_str(), "w");
+  if (!fp) {
+    fprintf(stderr, "Error: cannot open %s\n", globalConfig.StatsJson.c_str());
+    return;
+  }
+  struct timeval end = getTime();
+  /* VmHWM is reset before every pass */
+  long peakKB = procStatusKB("VmHWM");
+  for (PassStat& stat : passStats) peakKB = MAX(peakKB, stat.peakKB);
+  fprintf(fp, "{\n  \"version\": \"%s\",\n  \"input\": \"%s\",\n", GSIM_VERSION, statsName(input).c_str());
+  fprintf(fp, "  \"wallMs\": %.3lf,\n  \"cpuMs\": %.3lf,\n  \"peakRssKB\": %ld,\n  \"passes\": [\n",
+          diffTime(start, end) / 1000.0, cpuTimeUs() / 1000.0, peakKB);
+  for (size_t i = 0; i < passStats.size(); i ++) {
+    PassStat& stat = passStats[i];
+    fprintf(fp, "    {\"name\": \"%s\", \"label\": \"%s\", \"wallMs\": %.3lf, \"cpuMs\": %.3lf, "
+                "\"rssBeforeKB\": %ld, \"rssAfterKB\": %ld, \"rssDeltaKB\": %ld, \"peakRssKB\": %ld, "
+                "\"nodesBefore\": %ld, \"nodesAfter\": %ld, \"superNodesBefore\": %ld, \"superNodesAfter\": %ld, "
+                "\"edgesBefore\": %ld, \"edgesAfter\": %ld}%s\n",
+            statsName(stat.name).c_str(), statsName(stat.label).c_str(), diffTime(stat.before.wall, stat.after.wall) / 1000.0,
+            (stat.after.cpuUs - stat.before.cpuUs) / 1000.0, stat.before.rssKB, stat.after.rssKB,
+            stat.after.rssKB - stat.before.rssKB, stat.peakKB, stat.before.nodeNum, stat.after.nodeNum,
+            stat.before.superNum, stat.after.superNum, stat.before.edgeNum, stat.after.edgeNum,
+            i + 1 == passStats.size() ? "" : ",");
+  }
+  fprintf(fp, "  ]\n}\n");
+  fclose(fp);
+}
 
 #define FUNC_WRAPPER_INTERNAL(func, name, dumpCond) \
   do { \
@@ -70,11 +205,14 @@ static inline bool shouldDumpStage(const std::string& name) {
       fprintf(stderr, "[GSIM] %s begin\n", name); \
       fflush(stderr); \
     } \
+    PassSample statsBefore; \
+    if (!globalConfig.StatsJson.empty()) statsBefore = beginPassStats(g); \
     struct timeval start = getTime(); \
     func; \
     struct timeval end = getTime(); \
     const char* label = strlen(name) ? name : "{" #func "}"; \
     showTime(label, start, end); \
+    if (!globalConfig.StatsJson.empty()) endPassStats(#func, label, statsBefore, g); \
     if (globalConfig.LogLevel > 0 && strlen(name) != 0) { \
       fprintf(stderr, "[GSIM] %s done\n", name); \
       fflush(stderr); \
@@ -115,6 +253,27 @@ static void printUsage(const char* ProgName) {
             << "      --dump-stages=a,b,c          Dump only the listed stages (e.g., Init,TopoSort,AliasAnalysis).\n"
             << "      --dump-assign-tree           Include assignTree structure in JSON dump (can be large).\n"
             << "      --dump-const-status          Dump per-node constant-analysis status before removing constants.\n"
+            << "      --threads=[num]              Evaluate the emitted model with num threads (default: 1).\n"
+            << "      --active-width=[8|16|32|64]  Bit width of each activeFlags word in the emitted model (default: 8).\n"
+            << "      --lanes=[num]                Simulate num independent copies of the design in one process, sharing the superNode schedule (no SIMD, default: 1).\n"
+            << "      --jobs=[num]                 Number of threads to parse the input (default: number of online CPUs).\n"
+            << "      --stats-json=[file]          Write per-pass time, memory and graph size statistics to file in JSON.\n"
+            << "      --activity-profile=[file]    Partition superNodes by the node activity recorded in file.\n"
+            << "      --instrument-activity        Sample superNode activity in the emitted model to write an activity profile.\n"
+            << "      --always-active-ratio=[0-1]  Evaluate superNodes activated in at least this ratio of cycles (by --activity-profile) unconditionally.\n"
+            << "      --cold-ratio=[0-1]           Outline superNodes activated in less than this ratio of cycles (by --activity-profile, otherwise\n"
+            << "                                   the ones only activated by reset) into cold functions.\n"
+            << "      --active-locality            Order superNodes so that the ones activated together share activeFlags words.\n"
+            << "      --state-layout               Place the model state in hot, cold and memory regions, grouped by superNode.\n"
+            << "      --sparse-memory-KB=[num]     Back memories of at least num KB with pages allocated on first access.\n"
+            << "      --wide-kernels               Evaluate bit fields, and/or/xor/not, cat and constant shifts of signals wider than 64 bits word by word.\n"
+            << "      --skip-idle                  Emit quiescent() and skipIdle(n) to fast-forward cycles where only free-running counters change.\n"
+            << "      --pure-extmodules=a,b,c      Declare the listed extmodules free of state and side effects, so --skip-idle may skip them.\n"
+            << "      --watch-outputs=a,b,c        Report changes of the listed outputs to the watch callback of run().\n"
+            << "      --lazy-outputs               Evaluate superNodes feeding only top-level outputs in the getters instead of step().\n"
+            << "      --port-manifest=FILE         Tie inputs to constants and prune the outputs not observed by the harness.\n"
+            << "      --lut-max-bits=[num]         Replace pure superNodes with at most num input bits (up to 20, e.g. 12) by lookup tables.\n"
+            << "      --pack-bits                  Evaluate independent 1-bit gates of a superNode bit-parallel in 64-bit words.\n"
             ;
 }
 
@@ -143,6 +302,26 @@ static char* parseCommandLine(int argc, char** argv) {
     OPT_DUMP_STAGES,
     OPT_DUMP_ASSIGN_TREE,
     OPT_DUMP_CONST_STATUS,
+    OPT_THREADS,
+    OPT_ACTIVE_WIDTH,
+    OPT_LANES,
+    OPT_JOBS,
+    OPT_STATS_JSON,
+    OPT_ACTIVITY_PROFILE,
+    OPT_INSTRUMENT_ACTIVITY,
+    OPT_ALWAYS_ACTIVE_RATIO,
+    OPT_ACTIVE_LOCALITY,
+    OPT_COLD_RATIO,
+    OPT_STATE_LAYOUT,
+    OPT_SPARSE_MEMORY,
+    OPT_WIDE_KERNELS,
+    OPT_SKIP_IDLE,
+    OPT_PURE_EXTMODULES,
+    OPT_WATCH_OUTPUTS,
+    OPT_LAZY_OUTPUTS,
+    OPT_PORT_MANIFEST,
+    OPT_LUT_MAX_BITS,
+    OPT_PACK_BITS,
   };
 
   const struct option Table[] = {
@@ -162,6 +341,26 @@ static char* parseCommandLine(int argc, char** argv) {
       {"dump-stages", required_argument, nullptr, 0},
       {"dump-assign-tree", no_argument, nullptr, 0},
       {"dump-const-status", no_argument, nullptr, 0},
+      {"threads", required_argument, nullptr, 0},
+      {"active-width", required_argument, nullptr, 0},
+      {"lanes", required_argument, nullptr, 0},
+      {"jobs", required_argument, nullptr, 0},
+      {"stats-json", required_argument, nullptr, 0},
+      {"activity-profile", required_argument, nullptr, 0},
+      {"instrument-activity", no_argument, nullptr, 0},
+      {"always-active-ratio", required_argument, nullptr, 0},
+      {"active-locality", no_argument, nullptr, 0},
+      {"cold-ratio", required_argument, nullptr, 0},
+      {"state-layout", no_argument, nullptr, 0},
+      {"sparse-memory-KB", required_argument, nullptr, 0},
+      {"wide-kernels", no_argument, nullptr, 0},
+      {"skip-idle", no_argument, nullptr, 0},
+      {"pure-extmodules", required_argument, nullptr, 0},
+      {"watch-outputs", required_argument, nullptr, 0},
+      {"lazy-outputs", no_argument, nullptr, 0},
+      {"port-manifest", required_argument, nullptr, 0},
+      {"lut-max-bits", required_argument, nullptr, 0},
+      {"pack-bits", no_argument, nullptr, 0},
       {nullptr, no_argument, nullptr, 0},
   };
 
@@ -222,6 +421,74 @@ static char* parseCommandLine(int argc, char** argv) {
                 case OPT_DUMP_CONST_STATUS:
                   globalConfig.DumpConstStatus = true;
                   break;
+                case OPT_THREADS:
+                  sscanf(optarg, "%d", &globalConfig.ThreadNum);
+                  if (globalConfig.ThreadNum < 1) globalConfig.ThreadNum = 1;
+                  break;
+                case OPT_ACTIVE_WIDTH:
+                  sscanf(optarg, "%d", &globalConfig.ActiveWidth);
+                  if (globalConfig.ActiveWidth != 8 && globalConfig.ActiveWidth != 16 &&
+                      globalConfig.ActiveWidth != 32 && globalConfig.ActiveWidth != 64) {
+                    fprintf(stderr, "Error: --active-width must be one of 8, 16, 32 and 64.\n");
+                    printUsage(argv[0]);
+                    std::cout.flush();
+                    fflush(nullptr);
+                    _exit(EXIT_FAILURE);
+                  }
+                  break;
+                case OPT_LANES:
+                  sscanf(optarg, "%d", &globalConfig.Lanes);
+                  if (globalConfig.Lanes < 1) globalConfig.Lanes = 1;
+                  break;
+                case OPT_JOBS:
+                  sscanf(optarg, "%d", &globalConfig.ParserJobs);
+                  if (globalConfig.ParserJobs < 1) globalConfig.ParserJobs = 1;
+                  break;
+                case OPT_STATS_JSON: globalConfig.StatsJson = optarg; break;
+                case OPT_ACTIVITY_PROFILE: globalConfig.ActivityProfile = optarg; break;
+                case OPT_INSTRUMENT_ACTIVITY: globalConfig.InstrumentActivity = true; break;
+                case OPT_ALWAYS_ACTIVE_RATIO:
+                  sscanf(optarg, "%lf", &globalConfig.AlwaysActiveRatio);
+                  globalConfig.AlwaysActiveRatio = MIN(globalConfig.AlwaysActiveRatio, 1.0);
+                  if (globalConfig.AlwaysActiveRatio < 0) globalConfig.AlwaysActiveRatio = 0;
+                  break;
+                case OPT_ACTIVE_LOCALITY: globalConfig.ActiveLocality = true; break;
+                case OPT_COLD_RATIO:
+                  sscanf(optarg, "%lf", &globalConfig.ColdRatio);
+                  globalConfig.ColdRatio = MIN(globalConfig.ColdRatio, 1.0);
+                  if (globalConfig.ColdRatio < 0) globalConfig.ColdRatio = 0;
+                  break;
+                case OPT_STATE_LAYOUT: globalConfig.StateLayout = true; break;
+                case OPT_SPARSE_MEMORY:
+                  sscanf(optarg, "%d", &globalConfig.SparseMemoryKB);
+                  if (globalConfig.SparseMemoryKB < 0) globalConfig.SparseMemoryKB = 0;
+                  break;
+                case OPT_WIDE_KERNELS: globalConfig.WideKernels = true; break;
+                case OPT_SKIP_IDLE: globalConfig.SkipIdle = true; break;
+                case OPT_PURE_EXTMODULES: {
+                  std::stringstream ss(optarg);
+                  std::string name;
+                  while (std::getline(ss, name, ',')) {
+                    if (!name.empty()) globalConfig.PureExtModules.push_back(name);
+                  }
+                  break;
+                }
+                case OPT_WATCH_OUTPUTS: {
+                  std::stringstream ss(optarg);
+                  std::string name;
+                  while (std::getline(ss, name, ',')) {
+                    if (!name.empty()) globalConfig.WatchOutputs.push_back(name);
+                  }
+                  break;
+                }
+                case OPT_LAZY_OUTPUTS: globalConfig.LazyOutputs = true; break;
+                case OPT_PORT_MANIFEST: globalConfig.PortManifest = optarg; break;
+                case OPT_LUT_MAX_BITS:
+                  sscanf(optarg, "%d", &globalConfig.LutMaxBits);
+                  globalConfig.LutMaxBits = MIN(globalConfig.LutMaxBits, 20);
+                  if (globalConfig.LutMaxBits < 0) globalConfig.LutMaxBits = 0;
+                  break;
+                case OPT_PACK_BITS: globalConfig.PackBits = true; break;
                 default: printUsage(argv[0]); std::cout.flush(); fflush(nullptr); _exit(EXIT_SUCCESS);
               }
               break;
@@ -276,6 +543,8 @@ int main(int argc, char** argv) {
   static int dumpIdx = 0;
   const char *InputFileName = parseCommandLine(argc, argv);
 
+  if (!globalConfig.ActivityProfile.empty()) FUNC_TIMER(loadActivityProfile(globalConfig.ActivityProfile));
+
   size_t size = 0, mapSize = 0;
   char *strbuf;
   FUNC_TIMER(strbuf = readFile(InputFileName, size, mapSize));
@@ -306,6 +575,8 @@ int main(int argc, char** argv) {
 
   FUNC_WRAPPER(g->removeDeadNodes(), "RemoveDeadNodes1");
 
+  if (!globalConfig.PortManifest.empty()) FUNC_TIMER(g->applyPortManifest(globalConfig.PortManifest));
+
   FUNC_WRAPPER(g->constantAnalysis(), "ConstantAnalysis");
 
   FUNC_WRAPPER(g->removeDeadNodes(), "RemoveDeadNodes");
@@ -322,16 +593,28 @@ int main(int argc, char** argv) {
 
   FUNC_WRAPPER(g->replicationOpt(), "Replication");
 
+  if (globalConfig.PackBits) FUNC_TIMER(g->packBits());
+
   // FUNC_WRAPPER(g->mergeRegister(), "MergeRegister");
 
   // FUNC_WRAPPER(g->constructRegs(), "ConstructRegs");
+  if (globalConfig.LutMaxBits > 0) FUNC_TIMER(g->splitLutCones());
+
+  if (globalConfig.LazyOutputs) FUNC_TIMER(g->splitOutputCones());
+
   FUNC_TIMER(g->generateStmtTree());
 
   FUNC_TIMER(g->instsGenerator());
 
+  if (globalConfig.LutMaxBits > 0) FUNC_TIMER(g->lutMemoize());
+
+  if (globalConfig.ActiveLocality) FUNC_TIMER(g->activeLocalityOrder());
+
   FUNC_WRAPPER(g->cppEmitter(), "Final");
 
   TIMER_END(total);
 
+  if (!globalConfig.StatsJson.empty()) writeStatsJson(InputFileName, CONCAT(__timer_, total));
+
   return 0;
 }
@@ -370,7 +370,7 @@ void graph::mergeIn1() {
 uint64_t prevHash(SuperNode* super) {
   uint64_t ret = super->prev.size()*7;
   for (SuperNode* prev : super->prev) {
-    ret += (uint64_t)prev;
+    ret += prev->id;
   }
   return ret;
 }
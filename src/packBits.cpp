@@ -0,0 +1,478 @@
+/*
+  packBits: evaluate independent 1-bit gates of a superNode bit-parallel
+  The 1-bit nodes of a superNode computed by and/or/xor/not/mux gates with the same shape and at
+  the same depth (so none of them depends on another) are packed into groups of at most 64. Every
+  group is computed by a new node whose bit i is the value of member i, so each gate of the shape
+  is evaluated once by a word operation for the whole group. The operands (leaves of the shape)
+  read from an earlier group, or selected by bits(x, i, i) from a node of at most 64 bits, are
+  taken as runs of that word; the other operands are gathered by cat. Members are ordered by the
+  positions of their operands, and a group is kept only if it is cheaper than its gates, including
+  the gathers of the groups reading it and the bits extracted for the nodes still reading members
+*/
+
+#include "common.h"
+#include <tuple>
+
+#define PACK_MAX_BITS 64
+#define PACK_MAX_OPERANDS 32 // leaves of a packed shape
+
+struct BitGroup {
+  SuperNode* super;
+  ENode* shape;  // root of the first member
+  size_t slots;  // operands of a member
+  int gates;     // cost of a member evaluated alone
+  int wordGates; // cost of the word operations
+  bool commutative; // a single and/or/xor of two operands
+  std::vector<Node*> members;
+  bool packed = true;
+  Node* word = nullptr;
+  std::set<int> neighbors; // groups whose cost depends on whether this group is packed
+};
+
+/* bit pos of a packed group, or of a node the operand selects a bit from (group < 0) */
+struct BitSource {
+  int group;
+  Node* node;
+  int pos;
+};
+
+/* a run of bits taken from the same source, or a single operand evaluated as it is */
+struct BitTerm {
+  int group;
+  Node* node;
+  int lo;
+  int len;
+  ENode* scalar;
+  bool broadcast; // the scalar is the operand of every member
+};
+
+static std::vector<BitGroup> groups;
+static std::map<Node*, std::pair<int, int>> bitSlot; // member -> (group, bit position)
+static std::map<Node*, std::vector<ENode*>> operands;
+
+static size_t opArity(OPType op) {
+  switch (op) {
+    case OP_AND: case OP_OR: case OP_XOR: return 2;
+    case OP_NOT: return 1;
+    case OP_MUX: return 3;
+    default: return 0;
+  }
+}
+
+static bool isGate(ENode* enode) {
+  size_t num = opArity(enode->opType);
+  return num != 0 && enode->getChildNum() == num && enode->width == 1 && !enode->sign;
+}
+
+/* signature of the gates, the leaves are the operands */
+static bool bitFormula(ENode* enode, std::string& shape, std::vector<ENode*>& leaves, int& gates, int& wordGates) {
+  if (!enode || enode->width != 1 || enode->sign || enode->isClock) return false;
+  if (!isGate(enode)) {
+    shape += "x";
+    leaves.push_back(enode);
+    return leaves.size() <= PACK_MAX_OPERANDS;
+  }
+  shape += std::to_string(enode->opType) + "(";
+  gates += enode->opType == OP_MUX ? 2 : 1;
+  wordGates += enode->opType == OP_MUX ? 3 : 1; // b ^ (c & (a ^ b))
+  for (ENode* child : enode->child) {
+    if (!bitFormula(child, shape, leaves, gates, wordGates)) return false;
+  }
+  shape += ")";
+  return true;
+}
+
+static bool packCandidate(Node* node, std::string& shape) {
+  if (node->status != VALID_NODE || node->type != NODE_OTHERS || node->width != 1 || node->sign) return false;
+  if (node->isArray() || node->isReset() || node->isClock || node->assignTree.size() != 1) return false;
+  ExpTree* tree = node->assignTree[0];
+  if (!tree->getlval() || tree->getlval()->getChildNum() != 0 || !isGate(tree->getRoot())) return false;
+  std::vector<ENode*> leaves;
+  int gates = 0, wordGates = 0;
+  return bitFormula(tree->getRoot(), shape, leaves, gates, wordGates);
+}
+
+/* depth of the members in the dependencies inside the superNode */
+static void superLevels(SuperNode* super, std::map<Node*, int>& level) {
+  std::map<Node*, int> prevNum;
+  std::vector<Node*> ready;
+  for (Node* member : super->member) {
+    int num = 0;
+    for (Node* prev : member->depPrev) {
+      if (prev->super == super) num ++;
+    }
+    prevNum[member] = num;
+    level[member] = 0;
+    if (num == 0) ready.push_back(member);
+  }
+  while (!ready.empty()) {
+    Node* node = ready.back();
+    ready.pop_back();
+    for (Node* next : node->depNext) {
+      if (next->super != super) continue;
+      level[next] = MAX(level[next], level[node] + 1);
+      if (-- prevNum[next] == 0) ready.push_back(next);
+    }
+  }
+}
+
+static bool isLeaf(ENode* enode) {
+  return enode && enode->nodePtr && enode->getChildNum() == 0;
+}
+
+static bool selectableNode(Node* node) {
+  return node->status == VALID_NODE && !node->isArray() && !node->sign && node->width > 0 && node->width <= 64;
+}
+
+static bool selectBit(ENode* enode, Node*& node, int& pos) {
+  if (enode->opType != OP_BITS || enode->getChildNum() != 1 || enode->values[0] != enode->values[1]) return false;
+  if (!isLeaf(enode->getChild(0)) || !selectableNode(enode->getChild(0)->nodePtr)) return false;
+  node = enode->getChild(0)->nodePtr;
+  pos = enode->values[1];
+  return true;
+}
+
+/* nodes only selecting a bit of an input or another node, which the words can read directly */
+static Node* selectorBase(Node* node, int& pos) {
+  if (node->status != VALID_NODE || node->type != NODE_OTHERS || node->isArray() || node->assignTree.size() != 1) return nullptr;
+  Node* base;
+  if (!selectBit(node->assignTree[0]->getRoot(), base, pos)) return nullptr;
+  return (base->type == NODE_INP || base->type == NODE_OTHERS) ? base : nullptr;
+}
+
+static bool bitSource(ENode* enode, SuperNode* super, BitSource& src) {
+  src.group = -1;
+  if (selectBit(enode, src.node, src.pos)) return true;
+  if (!isLeaf(enode)) return false;
+  auto iter = bitSlot.find(enode->nodePtr);
+  if (iter != bitSlot.end()) {
+    BitGroup& group = groups[iter->second.first];
+    if (!group.packed || group.super != super) return false;
+    src.group = iter->second.first;
+    src.node = nullptr;
+    src.pos = iter->second.second;
+    return true;
+  }
+  src.node = selectorBase(enode->nodePtr, src.pos);
+  return src.node != nullptr;
+}
+
+static int sourceWidth(int group, Node* node) {
+  return group >= 0 ? (int)groups[group].members.size() : node->width;
+}
+
+static bool readsNode(ENode* enode, Node* node) {
+  if (!enode) return false;
+  if (enode->nodePtr == node) return true;
+  for (ENode* child : enode->child) {
+    if (readsNode(child, node)) return true;
+  }
+  return false;
+}
+
+/* the member (or selector) is read by a node that does not take it from a word */
+static bool needsScalar(Node* member) {
+  bool isMember = bitSlot.find(member) != bitSlot.end();
+  for (Node* next : member->next) {
+    auto iter = bitSlot.find(next);
+    if (iter == bitSlot.end() || !groups[iter->second.first].packed) return true;
+    if (isMember && next->super != member->super) return true;
+    for (ENode* operand : operands[next]) {
+      bool direct = isLeaf(operand) && operand->nodePtr == member;
+      if (!direct && readsNode(operand, member)) return true;
+    }
+  }
+  return false;
+}
+
+/* members and selectors read as a scalar would not be removed */
+static bool sameOperand(ENode* a, ENode* b) {
+  int pos;
+  if (isLeaf(a)) return isLeaf(b) && a->nodePtr == b->nodePtr && bitSlot.find(a->nodePtr) == bitSlot.end() && !selectorBase(a->nodePtr, pos);
+  return a->opType == OP_INT && b->opType == OP_INT && a->strVal == b->strVal;
+}
+
+static void collectTerms(BitGroup& group, size_t slot, std::vector<BitTerm>& terms) {
+  terms.clear();
+  ENode* first = operands[group.members[0]][slot];
+  bool broadcast = true;
+  for (Node* member : group.members) broadcast = broadcast && sameOperand(first, operands[member][slot]);
+  if (broadcast) {
+    terms.push_back({-1, nullptr, 0, (int)group.members.size(), first, true});
+    return;
+  }
+  for (size_t i = 0; i < group.members.size(); i ++) {
+    ENode* operand = operands[group.members[i]][slot];
+    BitSource src;
+    if (!bitSource(operand, group.super, src)) {
+      terms.push_back({-1, nullptr, 0, 1, operand, false});
+      continue;
+    }
+    if (!terms.empty()) {
+      BitTerm& last = terms.back();
+      if (!last.scalar && last.group == src.group && last.node == src.node && last.lo + last.len == src.pos) {
+        last.len ++;
+        continue;
+      }
+    }
+    terms.push_back({src.group, src.node, src.pos, 1, nullptr, false});
+  }
+}
+
+static int gatherCost(std::vector<BitTerm>& terms) {
+  BitTerm& first = terms[0];
+  if (first.broadcast) return first.scalar->opType == OP_INT ? 0 : 2;
+  if (terms.size() == 1 && !first.scalar && first.lo == 0 && first.len == sourceWidth(first.group, first.node)) return 0;
+  int cost = 2 * (terms.size() - 1); // shift and or
+  for (BitTerm& term : terms) {
+    if (term.scalar) continue;
+    if (term.lo != 0) cost ++;
+    if (term.lo + term.len != sourceWidth(term.group, term.node)) cost ++;
+  }
+  return cost;
+}
+
+static int groupCost(int idx) {
+  BitGroup& group = groups[idx];
+  if (!group.packed) return group.members.size() * group.gates;
+  int cost = group.wordGates;
+  std::vector<BitTerm> terms;
+  for (size_t slot = 0; slot < group.slots; slot ++) {
+    collectTerms(group, slot, terms);
+    cost += gatherCost(terms);
+  }
+  for (Node* member : group.members) {
+    if (needsScalar(member)) cost += 2;
+  }
+  return cost;
+}
+
+static int localCost(int idx) {
+  int cost = groupCost(idx);
+  for (int neighbor : groups[idx].neighbors) cost += groupCost(neighbor);
+  return cost;
+}
+
+static void initGroup(BitGroup& group, ENode* shape) {
+  std::string signature;
+  std::vector<ENode*> leaves;
+  group.shape = shape;
+  group.gates = group.wordGates = 0;
+  bitFormula(shape, signature, leaves, group.gates, group.wordGates);
+  group.slots = leaves.size();
+  group.commutative = shape->opType != OP_MUX && shape->getChildNum() == 2 && !isGate(shape->getChild(0)) && !isGate(shape->getChild(1));
+}
+
+/* order the members by the positions of their operands in earlier groups */
+static void alignGroup(int idx) {
+  BitGroup& group = groups[idx];
+  std::map<Node*, std::tuple<int, int, int>> key; // groups, then nodes, then the members without sources
+  for (size_t i = 0; i < group.members.size(); i ++) {
+    Node* member = group.members[i];
+    std::vector<ENode*>& ops = operands[member];
+    std::string shape;
+    int gates = 0, wordGates = 0;
+    ops.clear();
+    bitFormula(member->assignTree[0]->getRoot(), shape, ops, gates, wordGates);
+    BitSource src;
+    if (group.commutative && !bitSource(ops[0], group.super, src) && bitSource(ops[1], group.super, src))
+      std::swap(ops[0], ops[1]);
+    key[member] = std::make_tuple(2, 0, (int)i);
+    for (ENode* operand : ops) {
+      if (!bitSource(operand, group.super, src)) continue;
+      if (src.group >= 0) key[member] = std::make_tuple(0, src.group, src.pos);
+      else key[member] = std::make_tuple(1, src.node->id, src.pos);
+      break;
+    }
+  }
+  std::stable_sort(group.members.begin(), group.members.end(), [&key](Node* a, Node* b) { return key[a] < key[b]; });
+  for (size_t i = 0; i < group.members.size(); i ++) bitSlot[group.members[i]] = std::make_pair(idx, (int)i);
+}
+
+static void collectGroups(SuperNode* super) {
+  std::map<Node*, int> level;
+  superLevels(super, level);
+  std::map<std::pair<int, std::string>, int> open;
+  size_t first = groups.size();
+  for (Node* member : super->member) {
+    std::string shape;
+    if (!packCandidate(member, shape)) continue;
+    auto key = std::make_pair(level[member], shape);
+    if (open.find(key) == open.end() || groups[open[key]].members.size() == PACK_MAX_BITS) {
+      open[key] = groups.size();
+      groups.emplace_back();
+      groups.back().super = super;
+      initGroup(groups.back(), member->assignTree[0]->getRoot());
+    }
+    groups[open[key]].members.push_back(member);
+  }
+  /* a single gate is not packed */
+  std::vector<std::pair<int, size_t>> order;
+  for (size_t i = first; i < groups.size(); i ++) {
+    if (groups[i].members.size() < 2) groups[i].packed = false;
+    else order.push_back(std::make_pair(level[groups[i].members[0]], i));
+  }
+  for (size_t i = first; i < groups.size(); i ++) {
+    if (!groups[i].packed) continue;
+    for (size_t j = 0; j < groups[i].members.size(); j ++) bitSlot[groups[i].members[j]] = std::make_pair(i, j);
+  }
+  std::sort(order.begin(), order.end());
+  for (auto iter : order) alignGroup(iter.second);
+}
+
+static ENode* wordLeaf(Node* word) {
+  ENode* leaf = new ENode(word);
+  leaf->setWidth(word->width, false);
+  return leaf;
+}
+
+static ENode* bitsOf(ENode* enode, int hi, int lo) {
+  ENode* bits = new ENode(OP_BITS);
+  bits->addChild(enode);
+  bits->addVal(hi);
+  bits->addVal(lo);
+  bits->setWidth(hi - lo + 1, false);
+  return bits;
+}
+
+static ENode* gatherOperand(BitGroup& group, size_t slot) {
+  std::vector<BitTerm> terms;
+  collectTerms(group, slot, terms);
+  int width = group.members.size();
+  if (terms[0].broadcast) { // x ? all ones : 0
+    ENode* mux = new ENode(OP_MUX);
+    mux->addChild(terms[0].scalar->dup());
+    mux->addChild(allocIntEnode(width, std::to_string(width == 64 ? UINT64_MAX : (((uint64_t)1 << width) - 1))));
+    mux->addChild(allocIntEnode(width, "0"));
+    mux->setWidth(width, false);
+    return mux;
+  }
+  ENode* ret = nullptr;
+  for (BitTerm& term : terms) {
+    ENode* enode;
+    if (term.scalar) enode = term.scalar->dup();
+    else {
+      Node* word = term.group >= 0 ? groups[term.group].word : term.node;
+      enode = wordLeaf(word);
+      if (term.lo != 0 || term.len != word->width) enode = bitsOf(enode, term.lo + term.len - 1, term.lo);
+    }
+    if (!ret) {
+      ret = enode;
+      continue;
+    }
+    ENode* cat = new ENode(OP_CAT);
+    cat->addChild(enode);
+    cat->addChild(ret);
+    cat->setWidth(enode->width + ret->width, false);
+    ret = cat;
+  }
+  return ret;
+}
+
+static ENode* wordOp(OPType op, ENode* a, ENode* b, int width) {
+  ENode* enode = new ENode(op);
+  enode->addChild(a);
+  if (b) enode->addChild(b);
+  enode->setWidth(width, false);
+  return enode;
+}
+
+static ENode* wordTree(BitGroup& group, ENode* enode, size_t& slot) {
+  if (!isGate(enode)) return gatherOperand(group, slot ++);
+  int width = group.members.size();
+  std::vector<ENode*> args;
+  for (ENode* child : enode->child) args.push_back(wordTree(group, child, slot));
+  switch (enode->opType) {
+    case OP_NOT: return wordOp(OP_NOT, args[0], nullptr, width);
+    case OP_MUX: return wordOp(OP_XOR, args[2], wordOp(OP_AND, args[0], wordOp(OP_XOR, args[1], args[2]->dup(), width), width), width);
+    default: return wordOp(enode->opType, args[0], args[1], width);
+  }
+}
+
+void graph::packBits() {
+  groups.clear();
+  bitSlot.clear();
+  operands.clear();
+  for (SuperNode* super : sortedSuper) {
+    if (super->superType == SUPER_VALID) collectGroups(super);
+  }
+  for (size_t i = 0; i < groups.size(); i ++) {
+    if (!groups[i].packed) continue;
+    for (Node* member : groups[i].members) {
+      for (ENode* operand : operands[member]) {
+        BitSource src;
+        if (!bitSource(operand, groups[i].super, src) || src.group < 0) continue;
+        groups[i].neighbors.insert(src.group);
+        groups[src.group].neighbors.insert(i);
+      }
+      for (Node* next : member->next) {
+        auto iter = bitSlot.find(next);
+        if (iter == bitSlot.end() || (size_t)iter->second.first == i) continue;
+        groups[i].neighbors.insert(iter->second.first);
+        groups[iter->second.first].neighbors.insert(i);
+      }
+    }
+  }
+  /* unpack a group whenever it lowers the cost of the group and of its neighbors */
+  std::vector<int> candidates;
+  for (size_t i = 0; i < groups.size(); i ++) {
+    if (groups[i].packed) candidates.push_back(i);
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int idx : candidates) {
+      int oldCost = localCost(idx);
+      groups[idx].packed = !groups[idx].packed;
+      if (localCost(idx) < oldCost) changed = true;
+      else groups[idx].packed = !groups[idx].packed;
+    }
+  }
+
+  size_t packedNum = 0, wordNum = 0, removeNum = 0;
+  for (BitGroup& group : groups) {
+    if (!group.packed) continue;
+    Node* first = group.members[0];
+    group.word = first->dup(NODE_OTHERS, format("%s$PACK", first->name.c_str()));
+    group.word->width = group.members.size();
+    group.word->sign = false;
+    group.word->super = group.super;
+    auto pos = std::find_first_of(group.super->member.begin(), group.super->member.end(), group.members.begin(), group.members.end());
+    group.super->member.insert(pos, group.word);
+  }
+  std::vector<std::pair<Node*, ENode*>> rewrite;
+  for (BitGroup& group : groups) {
+    if (!group.packed) continue;
+    size_t slot = 0;
+    group.word->assignTree.push_back(new ExpTree(wordTree(group, group.shape, slot), new ENode(group.word)));
+    for (size_t i = 0; i < group.members.size(); i ++) {
+      Node* member = group.members[i];
+      if (needsScalar(member)) rewrite.push_back(std::make_pair(member, bitsOf(wordLeaf(group.word), i, i)));
+      else {
+        member->status = DEAD_NODE;
+        removeNum ++;
+      }
+    }
+    packedNum += group.members.size();
+    wordNum ++;
+  }
+  for (auto iter : rewrite) iter.first->assignTree[0]->setRoot(iter.second);
+  std::set<Node*> selectors;
+  for (BitGroup& group : groups) {
+    if (!group.packed) continue;
+    for (Node* member : group.members) {
+      for (ENode* operand : operands[member]) {
+        int pos;
+        if (isLeaf(operand) && bitSlot.find(operand->nodePtr) == bitSlot.end() && selectorBase(operand->nodePtr, pos)) selectors.insert(operand->nodePtr);
+      }
+    }
+  }
+  for (Node* node : selectors) {
+    if (needsScalar(node)) continue;
+    node->status = DEAD_NODE;
+    removeNum ++;
+  }
+  removeNodesNoConnect(DEAD_NODE);
+  reconnectAll();
+  printf("[packBits] pack %ld 1-bit nodes into %ld words (%ld nodes removed)\n", packedNum, wordNum, removeNum);
+}
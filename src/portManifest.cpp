@@ -0,0 +1,74 @@
+/*
+  portManifest: the top-level ports used by the harness, one entry per line ('#' starts a comment):
+    input <name> <value>   the input is tied to the constant (decimal, 0x hex, negative values are two's complement)
+    output <name>          the output is read by the harness
+  tied inputs are folded by constantAnalysis, and if any output is listed, the other outputs are
+  turned into internal nodes, so that removeDeadNodes deletes the cones reaching only them
+*/
+
+#include "common.h"
+#include <fstream>
+
+void graph::applyPortManifest(std::string path) {
+  std::ifstream in(path);
+  Assert(in.is_open(), "cannot open port manifest %s", path.c_str());
+  std::map<std::string, Node*> inputs, outputs;
+  for (Node* node : input) inputs[node->name] = node;
+  for (Node* node : output) outputs[node->name] = node;
+  std::set<Node*> observed;
+  int tiedNum = 0;
+  std::string line;
+  int lineno = 0;
+  while (std::getline(in, line)) {
+    lineno ++;
+    size_t comment = line.find('#');
+    if (comment != std::string::npos) line.erase(comment);
+    std::istringstream ss(line);
+    std::string kind, name;
+    if (!(ss >> kind)) continue;
+    Assert(ss >> name, "%s:%d: expect input <name> <value> or output <name>", path.c_str(), lineno);
+    if (kind == "output") {
+      Assert(outputs.find(name) != outputs.end(), "%s:%d: %s is not a top-level output", path.c_str(), lineno, name.c_str());
+      observed.insert(outputs[name]);
+      continue;
+    }
+    std::string valStr;
+    Assert(kind == "input" && (ss >> valStr), "%s:%d: expect input <name> <value> or output <name>", path.c_str(), lineno);
+    Assert(inputs.find(name) != inputs.end(), "%s:%d: %s is not a top-level input", path.c_str(), lineno, name.c_str());
+    Node* node = inputs[name];
+    Assert(!node->isArray() && node->assignTree.empty(), "%s:%d: %s can not be tied", path.c_str(), lineno, name.c_str());
+    mpz_t val;
+    mpz_init(val);
+    Assert(mpz_set_str(val, valStr.c_str(), 0) == 0, "%s:%d: invalid value %s", path.c_str(), lineno, valStr.c_str());
+    mpz_fdiv_r_2exp(val, val, node->width); // the bits of the port
+    if (node->sign && node->width > 0 && mpz_tstbit(val, node->width - 1)) {
+      mpz_t range;
+      mpz_init(range);
+      mpz_setbit(range, node->width);
+      mpz_sub(val, val, range);
+      mpz_clear(range);
+    }
+    char* str = mpz_get_str(NULL, 10, val);
+    node->assignTree.push_back(new ExpTree(allocIntEnode(node->width, str, node->sign), node));
+    void (*freeFunc)(void*, size_t);
+    mp_get_memory_functions(NULL, NULL, &freeFunc);
+    freeFunc(str, strlen(str) + 1);
+    mpz_clear(val);
+    tiedNum ++;
+  }
+
+  size_t prunedNum = 0;
+  if (!observed.empty()) {
+    std::vector<Node*> kept;
+    for (Node* node : output) {
+      if (observed.find(node) != observed.end()) kept.push_back(node);
+      else {
+        node->type = NODE_OTHERS; // removed by removeDeadNodes unless used inside
+        prunedNum ++;
+      }
+    }
+    output = kept;
+  }
+  printf("[portManifest] %d inputs are tied to constants, %ld of %ld outputs are not observed\n",
+        tiedNum, prunedNum, prunedNum + output.size());
+}
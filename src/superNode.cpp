@@ -19,6 +19,11 @@ void SuperNode::addPrev(std::set<SuperNode*>& super) {
   depPrev.insert(super.begin(), super.end());
 }
 
+void SuperNode::addPrev(AdjList<SuperNode>& super) {
+  prev.insert(super.begin(), super.end());
+  depPrev.insert(super.begin(), super.end());
+}
+
 void SuperNode::erasePrev(SuperNode* node) {
   prev.erase(node);
   depPrev.erase(node);
@@ -42,6 +47,11 @@ void SuperNode::addNext(std::set<SuperNode*>& super) {
   depNext.insert(super.begin(), super.end());
 }
 
+void SuperNode::addNext(AdjList<SuperNode>& super) {
+  next.insert(super.begin(), super.end());
+  depNext.insert(super.begin(), super.end());
+}
+
 void SuperNode::eraseDepNext(SuperNode* node) {
   depNext.erase(node);
 }
@@ -54,3 +64,12 @@ void SuperNode::eraseNext(SuperNode* node) {
   next.erase(node);
   depNext.erase(node);
 }
+
+/* printf, assert and extmodules have side effects, so such superNodes keep their sequential order */
+bool SuperNode::isSerial() {
+  if (superType == SUPER_EXTMOD) return true;
+  for (Node* node : member) {
+    if (node->type == NODE_SPECIAL) return true;
+  }
+  return false;
+}
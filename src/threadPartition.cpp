@@ -0,0 +1,105 @@
+/*
+  threadPartition: distribute the emitted superNodes among threads for threaded evaluation
+  every thread evaluates its superNodes in cppId order; a superNode waits for the
+  progress of other threads only if one of its predecessors is placed there
+*/
+
+#include "common.h"
+#include <map>
+#include <climits>
+
+#define COMM_COST 16 // estimated cost (in insts) of a cross-thread synchronization
+
+static size_t superCost(SuperNode* super) {
+  return MAX(super->insts.size(), (size_t)1);
+}
+
+void graph::threadPartition(std::vector<SuperNode*>& emitSuper) {
+  int threadNum = globalConfig.ThreadNum;
+  std::map<SuperNode*, std::set<SuperNode*>> preds;
+  /* superNodes without code are skipped by the emitter, dependencies are passed through them */
+  std::map<SuperNode*, std::set<SuperNode*>> emptyPreds;
+  for (SuperNode* super : sortedSuper) {
+    std::set<SuperNode*> allPrev;
+    for (SuperNode* prev : super->depPrev) {
+      if (prev->cppId >= 0) allPrev.insert(prev);
+      else if (emptyPreds.find(prev) != emptyPreds.end()) allPrev.insert(emptyPreds[prev].begin(), emptyPreds[prev].end());
+    }
+    if (super->cppId >= 0) preds[super].insert(allPrev.begin(), allPrev.end());
+    else emptyPreds[super] = allPrev;
+  }
+  /* activating a superNode orders the activator and the activated superNode as the sequential evaluation does */
+  for (SuperNode* super : emitSuper) {
+    for (Node* member : super->member) {
+      if (member->status != VALID_NODE) continue;
+      for (int id : member->nextActiveId) {
+        if (id == super->cppId || id >= (int)emitSuper.size()) continue; // lazy superNodes are not in step()
+        SuperNode* activated = emitSuper[id];
+        if (id < super->cppId) preds[super].insert(activated);
+        else preds[activated].insert(super);
+      }
+    }
+  }
+  /* printf, assert and extmodules keep their sequential order in thread 0 */
+  SuperNode* prevSerial = nullptr;
+  for (SuperNode* super : emitSuper) {
+    if (!super->isSerial()) continue;
+    if (prevSerial) preds[super].insert(prevSerial);
+    prevSerial = super;
+  }
+
+  /* list scheduling in cppId order, which is a topological order of preds */
+  std::vector<size_t> threadFinish(threadNum, 0);
+  std::map<SuperNode*, size_t> finish;
+  threadTasks.assign(threadNum, std::vector<SuperNode*>());
+  for (SuperNode* super : emitSuper) {
+    int bestThread = 0;
+    size_t bestStart = SIZE_MAX;
+    for (int t = 0; t < (super->isSerial() ? 1 : threadNum); t ++) {
+      size_t start = threadFinish[t];
+      for (SuperNode* prev : preds[super]) {
+        start = MAX(start, finish[prev] + (prev->threadId == t ? 0 : COMM_COST));
+      }
+      if (start < bestStart) {
+        bestStart = start;
+        bestThread = t;
+      }
+    }
+    super->threadId = bestThread;
+    finish[super] = bestStart + superCost(super);
+    threadFinish[bestThread] = finish[super];
+    threadTasks[bestThread].push_back(super);
+    super->threadPos = threadTasks[bestThread].size();
+  }
+
+  /* only wait for the latest predecessor in every other thread */
+  size_t waitNum = 0;
+  for (int t = 0; t < threadNum; t ++) {
+    std::vector<int> waited(threadNum, 0);
+    for (SuperNode* super : threadTasks[t]) {
+      std::vector<int> required(threadNum, 0);
+      for (SuperNode* prev : preds[super]) {
+        if (prev->threadId == t) continue;
+        required[prev->threadId] = MAX(required[prev->threadId], prev->threadPos);
+      }
+      for (int u = 0; u < threadNum; u ++) {
+        if (required[u] <= waited[u]) continue;
+        super->threadWait.push_back(std::make_pair(u, required[u]));
+        threadTasks[u][required[u] - 1]->threadPublish = true;
+        waited[u] = required[u];
+        waitNum ++;
+      }
+    }
+  }
+
+  size_t totalCost = 0;
+  for (SuperNode* super : emitSuper) totalCost += superCost(super);
+  size_t span = *std::max_element(threadFinish.begin(), threadFinish.end());
+  printf("[threadPartition] %d threads, %ld superNodes, %ld cross-thread waits, estimated speedup %.2lf\n",
+        threadNum, emitSuper.size(), waitNum, span == 0 ? 1.0 : (double)totalCost / span);
+  for (int t = 0; t < threadNum; t ++) {
+    size_t cost = 0;
+    for (SuperNode* super : threadTasks[t]) cost += superCost(super);
+    printf("[threadPartition] thread %d: %ld superNodes, cost %ld\n", t, threadTasks[t].size(), cost);
+  }
+}